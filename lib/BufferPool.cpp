@@ -0,0 +1,132 @@
+#include <motioncam/BufferPool.hpp>
+
+namespace motioncam {
+    namespace {
+        const size_t MIN_CLASS_SIZE = 4096;
+        const size_t SHARED_POOL_BYTES = 1024 * 1024 * 1024;
+    
+        size_t getClassSize(const size_t size) {
+            if(size <= MIN_CLASS_SIZE)
+                return MIN_CLASS_SIZE;
+            
+            // Round up to the next quarter of a power of two
+            size_t power = MIN_CLASS_SIZE;
+            while(power * 2 < size)
+                power *= 2;
+            
+            const size_t step = power / 4;
+            
+            return (size + step - 1) / step * step;
+        }
+    }
+    
+    //
+    
+    PooledBuffer::PooledBuffer() : mPool(nullptr), mSize(0), mCapacity(0) {
+    }
+    
+    PooledBuffer::PooledBuffer(BufferPool* pool, std::unique_ptr<uint8_t[]> data, size_t size, size_t capacity) :
+        mPool(pool), mData(std::move(data)), mSize(size), mCapacity(capacity)
+    {
+    }
+    
+    PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept :
+        mPool(other.mPool), mData(std::move(other.mData)), mSize(other.mSize), mCapacity(other.mCapacity)
+    {
+        other.mPool = nullptr;
+        other.mSize = 0;
+        other.mCapacity = 0;
+    }
+    
+    PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+        if(this != &other) {
+            reset();
+            
+            mPool = other.mPool;
+            mData = std::move(other.mData);
+            mSize = other.mSize;
+            mCapacity = other.mCapacity;
+            
+            other.mPool = nullptr;
+            other.mSize = 0;
+            other.mCapacity = 0;
+        }
+        
+        return *this;
+    }
+    
+    PooledBuffer::~PooledBuffer() {
+        reset();
+    }
+    
+    void PooledBuffer::reset() {
+        if(mPool && mData)
+            mPool->release(std::move(mData), mCapacity);
+        
+        mData.reset();
+        mPool = nullptr;
+        mSize = 0;
+        mCapacity = 0;
+    }
+    
+    //
+    
+    BufferPool::BufferPool(const size_t maxPooledBytes) :
+        mMaxPooledBytes(maxPooledBytes), mBytesPooled(0), mAllocations(0), mHits(0)
+    {
+    }
+    
+    PooledBuffer BufferPool::acquire(const size_t size) {
+        const size_t classSize = getClassSize(size);
+        
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            
+            auto it = mBuffers.find(classSize);
+            if(it != mBuffers.end() && !it->second.empty()) {
+                std::unique_ptr<uint8_t[]> data = std::move(it->second.back());
+                it->second.pop_back();
+                
+                mBytesPooled -= classSize;
+                mHits++;
+                
+                return PooledBuffer(this, std::move(data), size, classSize);
+            }
+            
+            mAllocations++;
+        }
+        
+        // Default initialised so the memory is not touched until it is used
+        return PooledBuffer(this, std::unique_ptr<uint8_t[]>(new uint8_t[classSize]), size, classSize);
+    }
+    
+    void BufferPool::release(std::unique_ptr<uint8_t[]> data, const size_t capacity) {
+        std::lock_guard<std::mutex> lock(mLock);
+        
+        if(mBytesPooled + capacity > mMaxPooledBytes)
+            return;
+        
+        mBuffers[capacity].push_back(std::move(data));
+        mBytesPooled += capacity;
+    }
+    
+    void BufferPool::clear() {
+        std::lock_guard<std::mutex> lock(mLock);
+        
+        mBuffers.clear();
+        mBytesPooled = 0;
+    }
+    
+    BufferPool::Stats BufferPool::stats() const {
+        std::lock_guard<std::mutex> lock(mLock);
+        
+        return Stats{ mAllocations, mHits, mBytesPooled };
+    }
+    
+    BufferPool& BufferPool::shared() {
+        // Never destroyed, buffers held in other static objects may be released after it would be
+        static BufferPool* pool = new BufferPool(SHARED_POOL_BYTES);
+        return *pool;
+    }
+    
+} // namespace motioncam
@@ -1,6 +1,7 @@
 #include <motioncam/Decoder.hpp>
 #include <motioncam/RawData.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
@@ -12,14 +13,18 @@
     
     #define FSEEK fseeko
     #define FTELL ftello
+
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #include <cerrno>
+    
+    #define HAVE_MMAP 1
 #else
     #error Unknown platform
 #endif
 
 namespace motioncam {
-    constexpr int MOTIONCAM_COMPRESSION_TYPE_LEGACY = 6;
-    constexpr int MOTIONCAM_COMPRESSION_TYPE = 7;
-
     namespace {
         class AudioChunkLoaderImpl : public AudioChunkLoader {
             public:
@@ -94,25 +99,57 @@ namespace motioncam {
     
     //
 
-    Decoder::Decoder(FILE* file) : mFile(file) {
+    Decoder::Decoder(FILE* file) : mFile(file), mMappedData(nullptr), mMappedSize(0), mDecodeThreads(1) {
         if(!mFile)
             throw IOException("Invalid file");
             
         init();
     }
 
-    Decoder::Decoder(const std::string& path) : mFile(std::fopen(path.c_str(), "rb")) {
+    Decoder::Decoder(const std::string& path, const bool memoryMap) :
+        mFile(std::fopen(path.c_str(), "rb")), mMappedData(nullptr), mMappedSize(0), mDecodeThreads(1) {
         if(!mFile)
             throw IOException("Failed to open " + path);
+        
+        // The destructor won't run if we throw, close the file we opened ourselves
+        try {
+            init();
             
-        init();
+            if(memoryMap)
+                mapFile();
+        }
+        catch(...) {
+            std::fclose(mFile);
+            throw;
+        }
     }
     
     Decoder::~Decoder() {
+#ifdef HAVE_MMAP
+        if(mMappedData)
+            munmap((void*)mMappedData, mMappedSize);
+#endif
         if(mFile)
             std::fclose(mFile);
     }
     
+    void Decoder::mapFile() {
+#ifdef HAVE_MMAP
+        struct stat st{};
+        
+        if(fstat(fileno(mFile), &st) != 0 || st.st_size <= 0)
+            throw IOException("Failed to get file size");
+        
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fileno(mFile), 0);
+        if(data == MAP_FAILED)
+            throw IOException("Failed to map file");
+        
+        mMappedData = static_cast<const uint8_t*>(data);
+        mMappedSize = static_cast<size_t>(st.st_size);
+#endif
+        // Without mmap support we keep reading through stdio
+    }
+    
     void Decoder::init() {
         Header header{};
         
@@ -181,52 +218,461 @@ namespace motioncam {
         return *mAudioLoader;
     }
     
-    void Decoder::loadFrame(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata) {
-        if(mFrameOffsetMap.find(timestamp) == mFrameOffsetMap.end())
+    void Decoder::setDecodeThreads(const int numThreads) {
+        mDecodeThreads = std::max(1, numThreads);
+    }
+    
+    bool Decoder::isMemoryMapped() const {
+        return mMappedData != nullptr;
+    }
+    
+    void Decoder::getFrameData(const Timestamp timestamp, BufferView& outData, BufferView& outMetadata) const {
+        if(!mMappedData)
+            throw IOException("Decoder is not memory mapped");
+        
+        auto it = mFrameOffsetMap.find(timestamp);
+        if(it == mFrameOffsetMap.end())
             throw IOException("Frame not found (timestamp: " + std::to_string(timestamp) + ")");
         
-        int64_t offset = mFrameOffsetMap.at(timestamp).offset;
+        size_t offset = static_cast<size_t>(it->second.offset);
+        Item bufferItem{};
         
-        if(FSEEK(mFile, offset, SEEK_SET) != 0)
+        if(offset + sizeof(Item) > mMappedSize)
             throw IOException("Invalid offset");
         
-        Item bufferItem{};
-        read(&bufferItem, sizeof(Item));
-
+        std::memcpy(&bufferItem, mMappedData + offset, sizeof(Item));
+        offset += sizeof(Item);
+        
         if(bufferItem.type != Type::BUFFER)
             throw IOException("Invalid buffer type");
-
-        mTmpBuffer.resize(bufferItem.size);
-
-        read(mTmpBuffer.data(), bufferItem.size);
-                
+        
+        if(offset + bufferItem.size + sizeof(Item) > mMappedSize)
+            throw IOException("Truncated buffer");
+        
+        outData.data = mMappedData + offset;
+        outData.size = bufferItem.size;
+        offset += bufferItem.size;
+        
         // Get metadata
         Item metadataItem{};
-        read(&metadataItem, sizeof(Item));
+        
+        std::memcpy(&metadataItem, mMappedData + offset, sizeof(Item));
+        offset += sizeof(Item);
         
         if(metadataItem.type != Type::METADATA)
             throw IOException("Invalid metadata");
         
-        std::vector<uint8_t> metadataJson(metadataItem.size);
-        read(metadataJson.data(), metadataItem.size);
+        if(offset + metadataItem.size > mMappedSize)
+            throw IOException("Truncated metadata");
+        
+        outMetadata.data = mMappedData + offset;
+        outMetadata.size = metadataItem.size;
+    }
+    
+    void Decoder::loadFrame(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata) const {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outMetadata);
+        decodeFrame(data, size, outMetadata, outData);
+    }
+    
+    void Decoder::loadFrame(
+        const Timestamp timestamp,
+        std::vector<uint16_t>& outData,
+        nlohmann::json& outMetadata,
+        std::vector<uint8_t>& scratch) const
+    {
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, [&](size_t n) { scratch.resize(n); return scratch.data(); }, data, size, outMetadata);
+        decodeFrame(data, size, outMetadata, outData);
+    }
+    
+    void Decoder::loadFrame(const Timestamp timestamp, PooledBuffer& outData, FrameInfo& outInfo) const {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outInfo.metadata);
+        
+        outInfo.width = outInfo.metadata["width"];
+        outInfo.height = outInfo.metadata["height"];
+        outInfo.compressionType = outInfo.metadata["compressionType"];
+        
+        outData = BufferPool::shared().acquire(sizeof(uint16_t) * outInfo.width * outInfo.height);
+        
+        decodeFrame(
+            data, size, outInfo.width, outInfo.height, outInfo.compressionType, outData.as<uint16_t>(), outInfo.width);
+    }
+    
+    void Decoder::loadFrame(const Timestamp timestamp, uint16_t* dst, const size_t dstStride, FrameInfo& outInfo) const {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outInfo.metadata);
+        
+        outInfo.width = outInfo.metadata["width"];
+        outInfo.height = outInfo.metadata["height"];
+        outInfo.compressionType = outInfo.metadata["compressionType"];
+        
+        if(dstStride < static_cast<size_t>(outInfo.width))
+            throw IOException("Output stride is smaller than the frame width");
+        
+        decodeFrame(data, size, outInfo.width, outInfo.height, outInfo.compressionType, dst, dstStride);
+    }
+    
+    void Decoder::loadFrameRows(
+        const Timestamp timestamp,
+        const int rowStart,
+        const int rowCount,
+        uint16_t* dst,
+        const size_t dstStride,
+        FrameInfo& outInfo) const
+    {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outInfo.metadata);
+        
+        outInfo.width = outInfo.metadata["width"];
+        outInfo.height = outInfo.metadata["height"];
+        outInfo.compressionType = outInfo.metadata["compressionType"];
+        
+        decodeFrameRows(data, size, outInfo, rowStart, rowCount, dst, dstStride);
+    }
+    
+    void Decoder::loadFrameRows(
+        const Timestamp timestamp,
+        const FrameInfo& info,
+        const int rowStart,
+        const int rowCount,
+        uint16_t* dst,
+        const size_t dstStride) const
+    {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrameData(timestamp, scratch, data, size);
+        decodeFrameRows(data, size, info, rowStart, rowCount, dst, dstStride);
+    }
+    
+    void Decoder::decodeFrameRows(
+        const uint8_t* data,
+        const size_t size,
+        const FrameInfo& info,
+        const int rowStart,
+        const int rowCount,
+        uint16_t* dst,
+        const size_t dstStride) const
+    {
+        const int width = info.width;
+        const int height = info.height;
+        
+        if(rowStart < 0 || rowCount <= 0 || rowStart + rowCount > height)
+            throw IOException("Invalid rows");
+        
+        if(dstStride < static_cast<size_t>(width))
+            throw IOException("Output stride is smaller than the frame width");
+        
+        if(info.compressionType == MOTIONCAM_COMPRESSION_TYPE) {
+            if(raw::DecodeRowRange(dst, dstStride, rowStart, rowCount, width, height, data, size, mDecodeThreads) <= 0)
+                throw IOException("Failed to uncompress frame");
+        }
+        else {
+            // Legacy frames can't be decoded in parts, copy the rows out of the full frame
+            PooledBuffer buffer = BufferPool::shared().acquire(sizeof(uint16_t) * width * height);
+            const uint16_t* frame = buffer.as<uint16_t>();
+            
+            decodeFrame(data, size, width, height, info.compressionType, buffer.as<uint16_t>(), width);
+            
+            for(int y = 0; y < rowCount; y++) {
+                std::memcpy(
+                    dst + static_cast<size_t>(y) * dstStride,
+                    frame + static_cast<size_t>(rowStart + y) * width,
+                    width * sizeof(uint16_t));
+            }
+        }
+    }
+    
+    void Decoder::getFrameInfo(const Timestamp timestamp, FrameInfo& outInfo) const {
+        if(mMappedData) {
+            BufferView data, metadata;
+            
+            getFrameData(timestamp, data, metadata);
+            
+            outInfo.metadata = nlohmann::json::parse(metadata.data, metadata.data + metadata.size);
+        }
+        else {
+            auto it = mFrameOffsetMap.find(timestamp);
+            if(it == mFrameOffsetMap.end())
+                throw IOException("Frame not found (timestamp: " + std::to_string(timestamp) + ")");
+            
+            int64_t offset = it->second.offset;
+            
+            Item bufferItem{};
+            readAt(&bufferItem, sizeof(Item), offset);
+            
+            if(bufferItem.type != Type::BUFFER)
+                throw IOException("Invalid buffer type");
+            
+            // Step over the frame data to the metadata that follows it
+            offset += sizeof(Item) + bufferItem.size;
+            
+            Item metadataItem{};
+            readAt(&metadataItem, sizeof(Item), offset);
+            
+            if(metadataItem.type != Type::METADATA)
+                throw IOException("Invalid metadata");
+            
+            std::vector<uint8_t> metadata(metadataItem.size);
+            readAt(metadata.data(), metadata.size(), offset + sizeof(Item));
+            
+            outInfo.metadata = nlohmann::json::parse(metadata.begin(), metadata.end());
+        }
         
-        std::string metadataString = std::string(metadataJson.begin(), metadataJson.end());
-        outMetadata = nlohmann::json::parse(metadataString);        
+        outInfo.width = outInfo.metadata["width"];
+        outInfo.height = outInfo.metadata["height"];
+        outInfo.compressionType = outInfo.metadata["compressionType"];
+    }
+    
+    void Decoder::loadFrameRegion(
+        const Timestamp timestamp,
+        const int x0,
+        const int y0,
+        const int regionWidth,
+        const int regionHeight,
+        std::vector<uint16_t>& outData,
+        nlohmann::json& outMetadata) const
+    {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outMetadata);
         
         const int width = outMetadata["width"];
         const int height = outMetadata["height"];
         const int compressionType = outMetadata["compressionType"];
-                    
-        // Decompress the buffer
-        const size_t outputSizeBytes = sizeof(uint16_t) * width*height;
-        outData.resize(outputSizeBytes);
+        
+        if(x0 < 0 || y0 < 0 || regionWidth <= 0 || regionHeight <= 0 || x0 + regionWidth > width || y0 + regionHeight > height)
+            throw IOException("Invalid region");
+        
+        outData.resize(static_cast<size_t>(regionWidth) * regionHeight);
         
         if(compressionType == MOTIONCAM_COMPRESSION_TYPE) {
-            if(raw::Decode(outData.data(), width, height, mTmpBuffer.data(), mTmpBuffer.size()) <= 0)
+            if(raw::DecodeRegion(outData.data(), regionWidth, x0, y0, regionWidth, regionHeight, width, height, data, size) <= 0)
+                throw IOException("Failed to uncompress frame");
+        }
+        else {
+            // Legacy frames can't be decoded in parts, crop the full frame instead
+            PooledBuffer buffer = BufferPool::shared().acquire(sizeof(uint16_t) * width * height);
+            const uint16_t* frame = buffer.as<uint16_t>();
+            
+            decodeFrame(data, size, width, height, compressionType, buffer.as<uint16_t>(), width);
+            
+            for(int y = 0; y < regionHeight; y++) {
+                std::memcpy(
+                    outData.data() + static_cast<size_t>(y) * regionWidth,
+                    frame + static_cast<size_t>(y0 + y) * width + x0,
+                    regionWidth * sizeof(uint16_t));
+            }
+        }
+    }
+    
+    void Decoder::loadFrameProxy(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata) const {
+        PooledBuffer scratch;
+        
+        const uint8_t* data;
+        size_t size;
+        
+        fetchFrame(timestamp, scratch, data, size, outMetadata);
+        
+        const int width = outMetadata["width"];
+        const int height = outMetadata["height"];
+        const int compressionType = outMetadata["compressionType"];
+        
+        const int halfWidth = width / 2;
+        const int halfHeight = height / 2;
+        const size_t planeSize = static_cast<size_t>(halfWidth) * halfHeight;
+        
+        outData.resize(4 * planeSize);
+        
+        if(compressionType == MOTIONCAM_COMPRESSION_TYPE) {
+            if(raw::DecodeHalfRes(outData.data(), width, height, data, size, mDecodeThreads) <= 0)
+                throw IOException("Failed to uncompress frame");
+        }
+        else {
+            // Legacy frames are stored row by row, decode in full and split out the channels
+            PooledBuffer buffer = BufferPool::shared().acquire(sizeof(uint16_t) * width * height);
+            const uint16_t* frame = buffer.as<uint16_t>();
+            
+            decodeFrame(data, size, width, height, compressionType, buffer.as<uint16_t>(), width);
+            
+            for(int y = 0; y < halfHeight; y++) {
+                const uint16_t* row0 = frame + static_cast<size_t>(2*y) * width;
+                const uint16_t* row1 = row0 + width;
+                
+                uint16_t* dst = outData.data() + static_cast<size_t>(y) * halfWidth;
+                
+                for(int x = 0; x < halfWidth; x++) {
+                    dst[x]               = row0[2*x];
+                    dst[x + planeSize]   = row0[2*x + 1];
+                    dst[x + 2*planeSize] = row1[2*x];
+                    dst[x + 3*planeSize] = row1[2*x + 1];
+                }
+            }
+        }
+    }
+    
+    void Decoder::fetchFrame(
+        const Timestamp timestamp,
+        PooledBuffer& scratch,
+        const uint8_t*& outData,
+        size_t& outSize,
+        nlohmann::json& outMetadata) const
+    {
+        auto allocate = [&](size_t n) {
+            scratch = BufferPool::shared().acquire(n);
+            return scratch.data();
+        };
+        
+        fetchFrame(timestamp, allocate, outData, outSize, outMetadata);
+    }
+    
+    void Decoder::fetchFrame(
+        const Timestamp timestamp,
+        const std::function<uint8_t*(size_t)>& allocate,
+        const uint8_t*& outData,
+        size_t& outSize,
+        nlohmann::json& outMetadata) const
+    {
+        if(mMappedData) {
+            BufferView data, metadata;
+            
+            getFrameData(timestamp, data, metadata);
+            
+            outMetadata = nlohmann::json::parse(metadata.data, metadata.data + metadata.size);
+            outData = data.data;
+            outSize = data.size;
+            return;
+        }
+        
+        auto it = mFrameOffsetMap.find(timestamp);
+        if(it == mFrameOffsetMap.end())
+            throw IOException("Frame not found (timestamp: " + std::to_string(timestamp) + ")");
+        
+        const int64_t offset = it->second.offset;
+        
+        Item bufferItem{};
+        readAt(&bufferItem, sizeof(Item), offset);
+
+        if(bufferItem.type != Type::BUFFER)
+            throw IOException("Invalid buffer type");
+
+        // Get metadata
+        Item metadataItem{};
+        readAt(&metadataItem, sizeof(Item), offset + sizeof(Item) + bufferItem.size);
+        
+        if(metadataItem.type != Type::METADATA)
+            throw IOException("Invalid metadata");
+        
+        // Read the buffer and the metadata that follows it in one go
+        const size_t metadataStart = bufferItem.size + sizeof(Item);
+        const size_t totalSize = metadataStart + metadataItem.size;
+        
+        uint8_t* scratch = allocate(totalSize);
+        readAt(scratch, totalSize, offset + sizeof(Item));
+        
+        outMetadata = nlohmann::json::parse(scratch + metadataStart, scratch + totalSize);
+        outData = scratch;
+        outSize = bufferItem.size;
+    }
+    
+    void Decoder::fetchFrameData(
+        const Timestamp timestamp,
+        PooledBuffer& scratch,
+        const uint8_t*& outData,
+        size_t& outSize) const
+    {
+        if(mMappedData) {
+            BufferView data, metadata;
+            
+            getFrameData(timestamp, data, metadata);
+            
+            outData = data.data;
+            outSize = data.size;
+            return;
+        }
+        
+        auto it = mFrameOffsetMap.find(timestamp);
+        if(it == mFrameOffsetMap.end())
+            throw IOException("Frame not found (timestamp: " + std::to_string(timestamp) + ")");
+        
+        const int64_t offset = it->second.offset;
+        
+        Item bufferItem{};
+        readAt(&bufferItem, sizeof(Item), offset);
+
+        if(bufferItem.type != Type::BUFFER)
+            throw IOException("Invalid buffer type");
+        
+        scratch = BufferPool::shared().acquire(bufferItem.size);
+        readAt(scratch.data(), bufferItem.size, offset + sizeof(Item));
+        
+        outData = scratch.data();
+        outSize = bufferItem.size;
+    }
+    
+    void Decoder::decodeFrame(const uint8_t* data, const size_t size, const nlohmann::json& metadata, std::vector<uint16_t>& outData) const {
+        const int width = metadata["width"];
+        const int height = metadata["height"];
+        const int compressionType = metadata["compressionType"];
+        
+        const size_t numPixels = static_cast<size_t>(width) * height;
+        
+        // Growing the vector would clear every new pixel just for the decoder to overwrite it. Decode straight into
+        // it when it already holds a frame this size or larger, otherwise into a pooled buffer that is copied in.
+        if(outData.size() >= numPixels) {
+            outData.resize(numPixels);
+            decodeFrame(data, size, width, height, compressionType, outData.data(), width);
+            return;
+        }
+        
+        PooledBuffer buffer = BufferPool::shared().acquire(sizeof(uint16_t) * numPixels);
+        const uint16_t* pixels = buffer.as<uint16_t>();
+        
+        decodeFrame(data, size, width, height, compressionType, buffer.as<uint16_t>(), width);
+        
+        outData.assign(pixels, pixels + numPixels);
+    }
+    
+    void Decoder::decodeFrame(
+        const uint8_t* data,
+        const size_t size,
+        const int width,
+        const int height,
+        const int compressionType,
+        uint16_t* dst,
+        const size_t dstStride) const
+    {
+        if(compressionType == MOTIONCAM_COMPRESSION_TYPE) {
+            if(raw::DecodeParallel(dst, dstStride, width, height, data, size, mDecodeThreads) <= 0)
                 throw IOException("Failed to uncompress frame");
         }
         else if(compressionType == MOTIONCAM_COMPRESSION_TYPE_LEGACY) {
-            if(raw::DecodeLegacy(outData.data(), width, height, mTmpBuffer.data(), mTmpBuffer.size()) <= 0)
+            if(raw::DecodeLegacyParallel(dst, dstStride, width, height, data, size, mDecodeThreads) <= 0)
                 throw IOException("Failed to uncompress legacy frame");
         }
         else {
@@ -249,7 +695,7 @@ namespace motioncam {
         read(&index, sizeof(BufferIndex));
         
         // Check validity of index
-        if(index.magicNumber != INDEX_MAGIC_NUMBER)
+        if(static_cast<uint32_t>(index.magicNumber) != INDEX_MAGIC_NUMBER)
             throw IOException("Corrupted file");
         
         mOffsets.resize(index.numOffsets);
@@ -317,5 +763,34 @@ namespace motioncam {
     void Decoder::read(void* data, size_t size, size_t items) const {
         ::motioncam::read(mFile, data, size, items);
     }
+    
+    void Decoder::readAt(void* data, size_t size, int64_t offset) const {
+#if defined(_WIN32)
+        // No positional reads, serialise access to the file position instead
+        std::lock_guard<std::mutex> lock(mReadLock);
+        
+        if(FSEEK(mFile, offset, SEEK_SET) != 0)
+            throw IOException("Invalid offset");
+        
+        ::motioncam::read(mFile, data, size);
+#else
+        auto* dst = static_cast<uint8_t*>(data);
+        const int fd = fileno(mFile);
+        
+        while(size > 0) {
+            ssize_t n = pread(fd, dst, size, static_cast<off_t>(offset));
+            
+            if(n < 0 && errno == EINTR)
+                continue;
+            
+            if(n <= 0)
+                throw IOException("Failed to read data");
+            
+            dst += n;
+            offset += n;
+            size -= static_cast<size_t>(n);
+        }
+#endif
+    }
 
 } // namespace motioncam
@@ -1,412 +1,39 @@
 #include <motioncam/RawData.hpp>
+#include <motioncam/ThreadPool.hpp>
+
+#include <algorithm>
 #include <vector>
 #include <cstring>
 
-#include <simde/x86/sse2.h>
-#include <simde/x86/sse4.1.h>
-
-#if defined(__GNUC__)
-#  define INLINE  __attribute__((always_inline))
-#  define RESTRICT __restrict__
-#elif defined(_MSC_VER)
-#  define INLINE __forceinline
-#  define RESTRICT __restrict
-#else
-#  define INLINE
-#  define RESTRICT
-#endif
+#include "RawData_Kernels.hpp"
 
 namespace motioncam {
     namespace raw {
     
     namespace {
-    const int ENCODING_BLOCK = 64;
     const int HEADER_LENGTH = 2;
-    const int METADATA_OFFSET = 16;
     
-    constexpr int ENCODING_BLOCK_LENGTH[] = {
-        0,
-        8,
-        16,
-        24,
-        32,
-        40,
-        48,
-        64,
-        64,
-        80,
-        80,
-        128,
-        128,
-        128,
-        128,
-        128,
-        128
-    };
-
-    struct UInt16x8 {
-        const simde__m128i d;
-
-        UInt16x8(
-            const uint16_t p0,
-            const uint16_t p1,
-            const uint16_t p2,
-            const uint16_t p3,
-            const uint16_t p4,
-            const uint16_t p5,
-            const uint16_t p6,
-            const uint16_t p7) :
-            d{ simde_mm_set_epi16(p7, p6, p5, p4, p3, p2, p1, p0) }
-        {
-        }
-
-        UInt16x8(const simde__m128i& src) : d{ src }
-        {
-        }
-
-        UInt16x8(const uint16_t val) : d{ simde_mm_set1_epi16(val) }
-        {
-        }
-
-        INLINE
-        UInt16x8 operator&(const UInt16x8& rhs) const {
-            return UInt16x8(simde_mm_and_si128(d, rhs.d));
-        }
-
-        INLINE
-        UInt16x8 operator|(const UInt16x8& rhs) const {
-            return UInt16x8(simde_mm_or_si128(d, rhs.d));
-        }
-
-        INLINE
-        UInt16x8 operator<<(const int16_t n) const {
-            simde__m128i shift = simde_mm_set_epi64x(0, n);
-            return UInt16x8(simde_mm_sll_epi16(d, shift));
-        }
-
-        INLINE
-        UInt16x8 operator>>(const int16_t n) const {
-            simde__m128i shift = simde_mm_set_epi64x(0, n);
-            return UInt16x8(simde_mm_srl_epi16(d, shift));
+    using detail::Region;
+    using detail::StripeMetadata;
+    
+    struct EncodedFrame {
+        uint32_t encodedWidth;
+        uint32_t encodedHeight;
+        uint32_t numStripes;
+        std::vector<uint16_t> bits;
+        std::vector<uint16_t> refs;
+        
+        StripeMetadata metadata() const {
+            return StripeMetadata{ encodedWidth, bits.data(), refs.data() };
         }
     };
-
-    INLINE
-    UInt16x8 Load(const uint8_t* src) {
-        // Load 8 bytes and zero-extend to 16 bits per element
-        simde__m128i temp = simde_mm_loadl_epi64((const simde__m128i*)src);
-        return UInt16x8(simde_mm_cvtepu8_epi16(temp));
-    }
-
-    INLINE
-    void Store(uint16_t* RESTRICT dst, const UInt16x8& src) {
-        simde_mm_storeu_si128((simde__m128i*)dst, src.d);
-    }
-
+    
     INLINE
     void DecodeHeader(uint8_t& bits, uint16_t& reference, const uint8_t* input) {
         bits = ((*input) >> 4) & 0x0F;
         reference = (*(input) & 0x0F) << 8 | *(input + 1);
     }
     
-    INLINE
-    const uint8_t* Decode1(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x01);
-        const UInt16x8 p = Load(input);
-
-        const UInt16x8 r0 =  p & N;
-        const UInt16x8 r1 = (p & (N << 1)) >> 1;
-        const UInt16x8 r2 = (p & (N << 2)) >> 2;
-        const UInt16x8 r3 = (p & (N << 3)) >> 3;
-        const UInt16x8 r4 = (p & (N << 4)) >> 4;
-        const UInt16x8 r5 = (p & (N << 5)) >> 5;
-        const UInt16x8 r6 = (p & (N << 6)) >> 6;
-        const UInt16x8 r7 = (p & (N << 7)) >> 7;
-
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        Store(output + 32, r4);
-        Store(output + 40, r5);
-        Store(output + 48, r6);
-        Store(output + 56, r7);
-        
-        return input + ENCODING_BLOCK_LENGTH[1];
-    }
-    
-    INLINE
-    const uint8_t* Decode2_One(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x03);
-        const UInt16x8 p = Load(input);
-
-        const UInt16x8 r0 =  p & N;
-        const UInt16x8 r1 = (p & (N << 2)) >> 2;
-        const UInt16x8 r2 = (p & (N << 4)) >> 4;
-        const UInt16x8 r3 = (p & (N << 6)) >> 6;
-        
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        
-        return input + 8;
-    }
-    
-    INLINE
-    const uint8_t* Decode2(uint16_t *RESTRICT output, const uint8_t* input) {
-        input = Decode2_One(output, input);
-        input = Decode2_One(output + 32, input);
-        
-        return input;
-    }
-    
-    INLINE
-    const uint8_t* Decode3(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x07);
-        const UInt16x8 T(0x03);
-        const UInt16x8 R(0x01);
-
-        const UInt16x8 p0 = Load(input);
-        const UInt16x8 p1 = Load(input+8);
-        const UInt16x8 p2 = Load(input+16);
-
-        const UInt16x8 r0  =  p0 & N;
-        const UInt16x8 r1  = (p0 & (N << 3)) >> 3;
-        const UInt16x8 _r2 = (p0 & (T << 6)) >> 6;
-
-        const UInt16x8 r3  =  p1 & N;
-        const UInt16x8 r4  = (p1 & (N << 3)) >> 3;
-        const UInt16x8 _r5 = (p1 & (T << 6)) >> 6;
-
-        const UInt16x8 r6  =  p2 & N;
-        const UInt16x8 r7  = (p2 & (N << 3)) >> 3;
-
-        // Restore upper bits
-        const UInt16x8 r2 = _r2 | (((p2 >> 6) & R) << 2);
-        const UInt16x8 r5 = _r5 | (((p2 >> 7) & R) << 2);
-
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        Store(output + 32, r4);
-        Store(output + 40, r5);
-        Store(output + 48, r6);
-        Store(output + 56, r7);
-        
-        return input + ENCODING_BLOCK_LENGTH[3];
-    }
-
-    INLINE
-    const uint8_t* Decode4_One(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x0F);
-        const UInt16x8 p = Load(input);
-       
-        const UInt16x8 r0 =  p & N;
-        const UInt16x8 r1 = (p & (N << 4)) >> 4;
-        
-        Store(output,    r0);
-        Store(output+8,  r1);
-        
-        return input + 8;
-    }
-    
-    INLINE
-    const uint8_t* Decode4(uint16_t *RESTRICT output, const uint8_t* input) {
-        input = Decode4_One(output, input);
-        input = Decode4_One(output + 16, input);
-        input = Decode4_One(output + 32, input);
-        input = Decode4_One(output + 48, input);
-        
-        return input;
-    }
-    
-    INLINE
-    const uint8_t* Decode5(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x1F);
-        const UInt16x8 L(0x07);
-        const UInt16x8 U(0x03);
-        const UInt16x8 F(0x01);
-
-        const UInt16x8 p0 = Load(input);
-        const UInt16x8 p1 = Load(input+8);
-        const UInt16x8 p2 = Load(input+16);
-        const UInt16x8 p3 = Load(input+24);
-        const UInt16x8 p4 = Load(input+32);
-
-        const UInt16x8 r0 =  p0 & N;
-        const UInt16x8 r1 =  p1 & N;
-        const UInt16x8 r2 =  p2 & N;
-        const UInt16x8 r3 =  p3 & N;
-        const UInt16x8 r4 =  p4 & N;
-        
-        const UInt16x8 r5 = (p0 >> 5) & L | (((p3 >> 5) & U) << 3);
-        const UInt16x8 r6 = (p1 >> 5) & L | (((p4 >> 5) & U) << 3);
-
-        const UInt16x8 tmp0 = (p2 >> 5) & L;
-        const UInt16x8 tmp1 = tmp0 | ((p3 >> 7) & F) << 3;
-        
-        const UInt16x8 r7   = tmp1 | ((p4 >> 7) & F) << 4;
-        
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        Store(output + 32, r4);
-        Store(output + 40, r5);
-        Store(output + 48, r6);
-        Store(output + 56, r7);
-
-        return input + ENCODING_BLOCK_LENGTH[5];
-    }
-    
-    INLINE
-    const uint8_t* Decode6(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0x3F);
-        const UInt16x8 L(0x03);
-
-        const UInt16x8 p0 = Load(input);
-        const UInt16x8 p1 = Load(input+8);
-        const UInt16x8 p2 = Load(input+16);
-        const UInt16x8 p3 = Load(input+24);
-        const UInt16x8 p4 = Load(input+32);
-        const UInt16x8 p5 = Load(input+40);
-
-        const UInt16x8 r0 =  p0 & N;
-        const UInt16x8 r1 =  p1 & N;
-        const UInt16x8 r2 =  p2 & N;
-        const UInt16x8 r3 =  p3 & N;
-        const UInt16x8 r4 =  p4 & N;
-        const UInt16x8 r5 =  p5 & N;
-
-        const UInt16x8 r6 =
-               ((p0 >> 6) & L)
-            | (((p1 >> 6) & L) << 2)
-            | (((p1 >> 6) & L) << 2)
-            | (((p2 >> 6) & L) << 4);
-            
-        const UInt16x8 r7 =
-               ((p3 >> 6) & L)
-            | (((p4 >> 6) & L) << 2)
-            | (((p5 >> 6) & L) << 4);
-        
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        Store(output + 32, r4);
-        Store(output + 40, r5);
-        Store(output + 48, r6);
-        Store(output + 56, r7);
-
-        return input + ENCODING_BLOCK_LENGTH[6];
-    }
-    
-    INLINE
-    const uint8_t* Decode8_One(uint16_t *RESTRICT output, const uint8_t* input) {
-        Store(output, Load(input));
-        
-        return input + 8;
-    }
-
-    INLINE
-    const uint8_t* Decode8(uint16_t *RESTRICT output, const uint8_t* input) {
-        input = Decode8_One(output, input);
-        input = Decode8_One(output + 8, input);
-        input = Decode8_One(output + 16, input);
-        input = Decode8_One(output + 24, input);
-
-        input = Decode8_One(output + 32, input);
-        input = Decode8_One(output + 40, input);
-        input = Decode8_One(output + 48, input);
-        input = Decode8_One(output + 56, input);
-
-        return input;
-    }
-
-    INLINE
-    const uint8_t* Decode10(uint16_t *RESTRICT output, const uint8_t* input) {
-        const UInt16x8 N(0xFF);
-        const UInt16x8 L(0x03);
-
-        const UInt16x8 p0 = Load(input);
-        const UInt16x8 p1 = Load(input+8);
-        const UInt16x8 p2 = Load(input+16);
-        const UInt16x8 p3 = Load(input+24);
-        const UInt16x8 p4 = Load(input+32);
-        const UInt16x8 p5 = Load(input+40);
-        const UInt16x8 p6 = Load(input+48);
-        const UInt16x8 p7 = Load(input+56);
-        const UInt16x8 p8 = Load(input+64);
-        const UInt16x8 p9 = Load(input+72);
-
-        const UInt16x8 _r0 = p0 & N;
-        const UInt16x8 _r1 = p1 & N;
-        const UInt16x8 _r2 = p2 & N;
-        const UInt16x8 _r3 = p3 & N;
-
-        const UInt16x8 r0 = _r0 | ((p4 & L)          << 8);
-        const UInt16x8 r1 = _r1 | ((p4 & (L << 2))   << 6);
-        const UInt16x8 r2 = _r2 | ((p4 & (L << 4))   << 4);
-        const UInt16x8 r3 = _r3 | ((p4 & (L << 6))   << 2);
-        
-        const UInt16x8 _r4 =  p5 & N;
-        const UInt16x8 _r5 =  p6 & N;
-        const UInt16x8 _r6 =  p7 & N;
-        const UInt16x8 _r7 =  p8 & N;
-
-        const UInt16x8 r4 = _r4 | ((p9 & L)          << 8);
-        const UInt16x8 r5 = _r5 | ((p9 & (L << 2))   << 6);
-        const UInt16x8 r6 = _r6 | ((p9 & (L << 4))   << 4);
-        const UInt16x8 r7 = _r7 | ((p9 & (L << 6))   << 2);
-
-        Store(output,      r0);
-        Store(output + 8,  r1);
-        Store(output + 16, r2);
-        Store(output + 24, r3);
-        Store(output + 32, r4);
-        Store(output + 40, r5);
-        Store(output + 48, r6);
-        Store(output + 56, r7);
-
-        return input + ENCODING_BLOCK_LENGTH[10];
-    }
-    
-    INLINE
-    const uint8_t* Decode16_ONE(uint16_t *RESTRICT output, const uint8_t* input) {
-        auto input16 = reinterpret_cast<const uint16_t*>(input);
-        
-        const UInt16x8 p(
-            input16[0],
-            input16[1],
-            input16[2],
-            input16[3],
-            input16[4],
-            input16[5],
-            input16[6],
-            input16[7]);
-        
-        Store(output, p);
-        
-        return input + 16;
-    }
-
-    INLINE
-    const uint8_t* Decode16(uint16_t *RESTRICT output, const uint8_t* input) {
-        input = Decode16_ONE(output,    input);
-        input = Decode16_ONE(output+8,  input);
-        input = Decode16_ONE(output+16, input);
-        input = Decode16_ONE(output+24, input);
-
-        input = Decode16_ONE(output+32, input);
-        input = Decode16_ONE(output+40, input);
-        input = Decode16_ONE(output+48, input);
-        input = Decode16_ONE(output+56, input);
-
-        return input;
-    }
-    
     INLINE
     size_t DecodeBlock(
         uint16_t *RESTRICT output,
@@ -415,49 +42,20 @@ namespace motioncam {
         const size_t offset,
         const size_t len)
     {
+        const size_t blockLength = EncodedLength(bits);
+
         // Don't decode if past end of input
-        if(offset + ENCODING_BLOCK_LENGTH[bits] > len)
+        if(offset + blockLength > len)
             return len - offset;
-     
-        input += offset;
 
-        switch (bits) {
-            case 0:
-                std::memset(output, 0, sizeof(uint16_t)*ENCODING_BLOCK);
-                break;
-            case 1:
-                Decode1(output, input);
-                break;
-            case 2:
-                Decode2(output, input);
-                break;
-            case 3:
-                Decode3(output, input);
-                break;
-            case 4:
-                Decode4(output, input);
-                break;
-            case 5:
-                Decode5(output, input);
-                break;
-            case 6:
-                Decode6(output, input);
-                break;
-            case 7:
-            case 8:
-                Decode8(output, input);
-                break;
-            case 9:
-            case 10:
-                Decode10(output, input);
-                break;
-            default:
-            case 16:
-                Decode16(output, input);
-                break;
-        }
+        UInt16x8 r[8];
+
+        UnpackBlocks<UInt16x8>(r, bits, input + offset);
 
-        return ENCODING_BLOCK_LENGTH[bits];
+        for(int i = 0; i < 8; i++)
+            simde_mm_storeu_si128((simde__m128i*)(output + 8*i), r[i].d);
+
+        return blockLength;
     }
     
     INLINE
@@ -473,7 +71,8 @@ namespace motioncam {
             |   (static_cast<uint32_t>(input[offset+2]) << 16)
             |   (static_cast<uint32_t>(input[offset+3]) << 24);
     
-        outMetadata.resize(numBlocks);
+        // Blocks are always decoded in full so leave room for the last one
+        outMetadata.resize((numBlocks + ENCODING_BLOCK - 1) / ENCODING_BLOCK * ENCODING_BLOCK);
         offset += 4;
         
         uint8_t bits;
@@ -482,7 +81,7 @@ namespace motioncam {
         // Decode bits
         uint16_t* data = outMetadata.data();
 
-        for(int i = 0; i < numBlocks; i+=ENCODING_BLOCK) {
+        for(size_t i = 0; i < numBlocks; i+=ENCODING_BLOCK) {
             DecodeHeader(bits, reference, input+offset);
             
             offset += HEADER_LENGTH;
@@ -523,6 +122,161 @@ namespace motioncam {
             |   (static_cast<uint32_t>(input[15]) << 24);
     }
     
+    bool DecodeFrameMetadata(const uint8_t* input, const size_t len, const int width, EncodedFrame& frame) {
+        uint32_t bitsOffset, refsOffset;
+        
+        if(len < METADATA_OFFSET)
+            return false;
+
+        ReadMetadataHeader(input, frame.encodedWidth, frame.encodedHeight, bitsOffset, refsOffset);
+        
+        if(bitsOffset > len || refsOffset > len)
+            return false;
+        
+        if(frame.encodedWidth % ENCODING_BLOCK > 0)
+            return false;
+            
+        if(frame.encodedWidth < static_cast<uint32_t>(width))
+            return false;
+
+        // Decode bits
+        DecodeMetadata(input, bitsOffset, len, frame.bits);
+        
+        // Decode refs
+        DecodeMetadata(input, refsOffset, len, frame.refs);
+        
+        frame.numStripes = (frame.encodedHeight + 3) / 4;
+        
+        // Each stripe holds four blocks per column
+        const size_t numBlocks = static_cast<size_t>(frame.numStripes) * (frame.encodedWidth / ENCODING_BLOCK) * 4;
+        
+        return frame.bits.size() >= numBlocks && frame.refs.size() >= numBlocks;
+    }
+    
+    size_t DecodeStripesSSE(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripes<UInt16x8>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    size_t DecodeStripesHalfResSSE(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripesHalfRes<UInt16x8>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    const detail::DecodeKernels KernelsSSE = { DecodeStripesSSE, DecodeStripesHalfResSSE };
+    
+    const detail::DecodeKernels& SelectKernels() {
+#if defined(MOTIONCAM_ENABLE_AVX)
+        __builtin_cpu_init();
+        
+        if(__builtin_cpu_supports("avx512bw"))
+            return detail::KernelsAVX512;
+        
+        if(__builtin_cpu_supports("avx2"))
+            return detail::KernelsAVX2;
+#endif
+        return KernelsSSE;
+    }
+    
+    // Picks the widest kernels the CPU supports the first time it is called
+    const detail::DecodeKernels& Kernels() {
+        static const detail::DecodeKernels& kernels = SelectKernels();
+        
+        return kernels;
+    }
+    
+    // Prefix sum of the block lengths, gives the offset of every stripe plus the end of the last one
+    void GetStripeOffsets(const EncodedFrame& frame, std::vector<size_t>& outOffsets) {
+        const size_t blocksPerStripe = (frame.encodedWidth / ENCODING_BLOCK) * 4;
+        
+        outOffsets.resize(frame.numStripes + 1);
+        
+        size_t offset = METADATA_OFFSET;
+        size_t metadataIdx = 0;
+        
+        for(uint32_t stripe = 0; stripe < frame.numStripes; stripe++) {
+            outOffsets[stripe] = offset;
+            
+            for(size_t i = 0; i < blocksPerStripe; i++)
+                offset += EncodedLength(frame.bits[metadataIdx++]);
+        }
+        
+        outOffsets[frame.numStripes] = offset;
+    }
+    
+    // Splits stripes [stripeStart, stripeEnd) into up to threadCount ranges that are decoded on the shared thread pool
+    size_t DecodeStripesParallel(
+        detail::DecodeStripesFunc decodeStripes,
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const EncodedFrame& frame,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd,
+        const int threadCount)
+    {
+        const StripeMetadata metadata = frame.metadata();
+        
+        if(threadCount <= 1 && stripeStart == 0)
+            return decodeStripes(output, region, input, len, metadata, METADATA_OFFSET, 0, stripeEnd);
+        
+        std::vector<size_t> stripeOffsets;
+        GetStripeOffsets(frame, stripeOffsets);
+        
+        const int numTasks = std::min(threadCount, static_cast<int>(stripeEnd - stripeStart));
+        
+        // Truncated input, let the serial path deal with it
+        if(numTasks <= 1 || stripeOffsets[stripeEnd] > len) {
+            const size_t offset = std::min(stripeOffsets[stripeStart], len);
+            
+            return decodeStripes(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+        }
+        
+        const uint32_t numStripes = stripeEnd - stripeStart;
+        std::vector<size_t> written(numTasks, 0);
+        
+        ThreadPool::shared().parallelFor(numTasks, [&](int task) {
+            const uint32_t start = stripeStart + static_cast<uint32_t>((static_cast<uint64_t>(numStripes) * task) / numTasks);
+            const uint32_t end = stripeStart + static_cast<uint32_t>((static_cast<uint64_t>(numStripes) * (task + 1)) / numTasks);
+            
+            written[task] = decodeStripes(output, region, input, len, metadata, stripeOffsets[start], start, end);
+        });
+        
+        size_t total = 0;
+        for(auto n : written)
+            total += n;
+        
+        return total;
+    }
+    
+    // The kernels only write rows covered by encoded stripes. Clear the rows of the region past rowEnd, which is
+    // in frame rows, so a frame encoded shorter than its height doesn't leave whatever was in the buffer before.
+    void ClearRowsBelow(uint16_t* output, const Region& region, const int rowEnd, const int numPlanes) {
+        const size_t planeSize = region.stride * region.height;
+        
+        for(int row = std::max(rowEnd - region.y0, 0); row < region.height; row++) {
+            for(int plane = 0; plane < numPlanes; plane++)
+                std::memset(output + plane*planeSize + static_cast<size_t>(row) * region.stride, 0, region.width * sizeof(uint16_t));
+        }
+    }
+    
     } // unnamed namespace
 
     size_t Decode(
@@ -532,82 +286,140 @@ namespace motioncam {
         const uint8_t* input,
         const size_t len)
     {
-        uint16_t* outputStart = output;
+        return DecodeParallel(output, width, height, input, len, 1);
+    }
+    
+    size_t DecodeParallel(
+        uint16_t* output,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        return DecodeParallel(output, width, width, height, input, len, threadCount);
+    }
+    
+    size_t DecodeParallel(
+        uint16_t* output,
+        const size_t stride,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        if(stride < static_cast<size_t>(width))
+            return 0;
         
-        uint16_t p0[ENCODING_BLOCK];
-        uint16_t p1[ENCODING_BLOCK];
-        uint16_t p2[ENCODING_BLOCK];
-        uint16_t p3[ENCODING_BLOCK];
-
-        std::vector<uint16_t> bits, refs;
-        uint32_t encodedWidth, encodedHeight, bitsOffset, refsOffset;
-
-        ReadMetadataHeader(input, encodedWidth, encodedHeight, bitsOffset, refsOffset);
+        EncodedFrame frame;
         
-        if(bitsOffset > len || refsOffset > len)
+        if(!DecodeFrameMetadata(input, len, width, frame))
             return 0;
         
-        if(encodedWidth % ENCODING_BLOCK > 0)
+        const Region region{ 0, 0, width, height, stride };
+        
+        ClearRowsBelow(output, region, static_cast<int>(frame.numStripes) * 4, 1);
+        
+        return DecodeStripesParallel(Kernels().decodeStripes, output, region, input, len, frame, 0, frame.numStripes, threadCount);
+    }
+    
+    size_t DecodeHalfRes(
+        uint16_t* output,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        EncodedFrame frame;
+        
+        if(!DecodeFrameMetadata(input, len, width, frame))
             return 0;
-            
-        if(encodedWidth < width)
+        
+        const Region region{ 0, 0, width / 2, height / 2, static_cast<size_t>(width / 2) };
+        
+        ClearRowsBelow(output, region, static_cast<int>(frame.numStripes) * 2, 4);
+        
+        return DecodeStripesParallel(
+            Kernels().decodeStripesHalfRes, output, region, input, len, frame, 0, frame.numStripes, threadCount);
+    }
+    
+    size_t DecodeRowRange(
+        uint16_t* output,
+        const size_t stride,
+        const int rowStart,
+        const int rowCount,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        if(rowStart < 0 || rowCount <= 0 || rowStart + rowCount > height || stride < static_cast<size_t>(width))
             return 0;
-
-        // Decode bits
-        DecodeMetadata(input, bitsOffset, len, bits);
         
-        // Decode refs
-        DecodeMetadata(input, refsOffset, len, refs);
-
+        EncodedFrame frame;
+        
+        if(!DecodeFrameMetadata(input, len, width, frame))
+            return 0;
+        
+        const Region region{ 0, rowStart, width, rowCount, stride };
+        
+        const uint32_t stripeStart = static_cast<uint32_t>(rowStart / 4);
+        const uint32_t stripeEnd = std::min(static_cast<uint32_t>((rowStart + rowCount + 3) / 4), frame.numStripes);
+        
+        if(stripeStart >= stripeEnd)
+            return 0;
+        
+        ClearRowsBelow(output, region, static_cast<int>(stripeEnd) * 4, 1);
+        
+        return DecodeStripesParallel(
+            Kernels().decodeStripes, output, region, input, len, frame, stripeStart, stripeEnd, threadCount);
+    }
+    
+    size_t DecodeRegion(
+        uint16_t* output,
+        const size_t stride,
+        const int x0,
+        const int y0,
+        const int regionWidth,
+        const int regionHeight,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len)
+    {
+        if(x0 < 0 || y0 < 0 || regionWidth <= 0 || regionHeight <= 0)
+            return 0;
+        
+        if(x0 + regionWidth > width || y0 + regionHeight > height || stride < static_cast<size_t>(regionWidth))
+            return 0;
+        
+        EncodedFrame frame;
+        
+        if(!DecodeFrameMetadata(input, len, width, frame))
+            return 0;
+        
+        const Region region{ x0, y0, regionWidth, regionHeight, stride };
+        
+        const uint32_t stripeStart = static_cast<uint32_t>(y0 / 4);
+        const uint32_t stripeEnd = std::min(static_cast<uint32_t>((y0 + regionHeight + 3) / 4), frame.numStripes);
+        
+        if(stripeStart >= stripeEnd)
+            return 0;
+        
+        ClearRowsBelow(output, region, static_cast<int>(stripeEnd) * 4, 1);
+        
+        // Skip the stripes above the region without unpacking them
+        const size_t numBlocks = static_cast<size_t>(stripeStart) * (frame.encodedWidth / ENCODING_BLOCK) * 4;
         size_t offset = METADATA_OFFSET;
         
-        std::vector<uint16_t> row0(encodedWidth);
-        std::vector<uint16_t> row1(encodedWidth);
-        std::vector<uint16_t> row2(encodedWidth);
-        std::vector<uint16_t> row3(encodedWidth);
+        for(size_t i = 0; i < numBlocks; i++)
+            offset += EncodedLength(frame.bits[i]);
         
-        int metadataIdx = 0;
-
-        for(int y = 0; y < encodedHeight; y+=4) {
-            for(int x = 0; x < encodedWidth; x += ENCODING_BLOCK) {
-                uint16_t blockBits[4] = { bits[metadataIdx], bits[metadataIdx+1], bits[metadataIdx+2], bits[metadataIdx+3] };
-                uint16_t blockRef[4] = { refs[metadataIdx], refs[metadataIdx+1], refs[metadataIdx+2], refs[metadataIdx+3] };
-            
-                offset += DecodeBlock(&p0[0], blockBits[0], input, offset, len);
-                offset += DecodeBlock(&p1[0], blockBits[1], input, offset, len);
-                offset += DecodeBlock(&p2[0], blockBits[2], input, offset, len);
-                offset += DecodeBlock(&p3[0], blockBits[3], input, offset, len);
-
-                for(int i = 0; i < ENCODING_BLOCK; i+=2) {
-                    row0[x + i]     = p0[i/2] + blockRef[0];
-                    row0[x + i + 1] = p1[i/2] + blockRef[1];
-                    
-                    row1[x + i]     = p2[i/2] + blockRef[2];
-                    row1[x + i + 1] = p3[i/2] + blockRef[3];
-
-                    row2[x + i]     = p0[ENCODING_BLOCK/2+i/2] + blockRef[0];
-                    row2[x + i + 1] = p1[ENCODING_BLOCK/2+i/2] + blockRef[1];
-                    
-                    row3[x + i]     = p2[ENCODING_BLOCK/2+i/2] + blockRef[2];
-                    row3[x + i + 1] = p3[ENCODING_BLOCK/2+i/2] + blockRef[3];
-                }
-                
-                metadataIdx += 4;
-            }
-
-            std::memcpy(output, row0.data(), width * 2);
-            output += width;
-
-            std::memcpy(output, row1.data(), width * 2);
-            output += width;
-
-            std::memcpy(output, row2.data(), width * 2);
-            output += width;
-
-            std::memcpy(output, row3.data(), width * 2);
-            output += width;
-        }
+        offset = std::min(offset, len);
         
-        return (output - outputStart);
+        return Kernels().decodeStripes(output, region, input, len, frame.metadata(), offset, stripeStart, stripeEnd);
     }
 }}
@@ -0,0 +1,49 @@
+// Built with -mavx2, only called when the CPU supports it
+#if defined(MOTIONCAM_ENABLE_AVX)
+
+#if !defined(__AVX2__)
+    #error RawData_AVX2.cpp must be compiled with AVX2 enabled
+#endif
+
+#include "RawData_Kernels.hpp"
+
+namespace motioncam {
+    namespace raw {
+    namespace detail {
+    
+    namespace {
+    
+    size_t DecodeStripesAVX2(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripes<UInt16x16>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    size_t DecodeStripesHalfResAVX2(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripesHalfRes<UInt16x16>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    } // unnamed namespace
+    
+    const DecodeKernels KernelsAVX2 = { DecodeStripesAVX2, DecodeStripesHalfResAVX2 };
+    
+    } // namespace detail
+}}
+
+#endif
@@ -0,0 +1,54 @@
+// Built with -mavx512f -mavx512bw, only called when the CPU supports it
+#if defined(MOTIONCAM_ENABLE_AVX)
+
+#if !defined(__AVX512BW__)
+    #error RawData_AVX512.cpp must be compiled with AVX-512BW enabled
+#endif
+
+// GCC 12 warns about the undefined lanes its own AVX-512 intrinsics start from (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13
+    #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "RawData_Kernels.hpp"
+
+namespace motioncam {
+    namespace raw {
+    namespace detail {
+    
+    namespace {
+    
+    size_t DecodeStripesAVX512(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripes<UInt16x32>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    size_t DecodeStripesHalfResAVX512(
+        uint16_t* output,
+        const Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        return DecodeStripesHalfRes<UInt16x32>(output, region, input, len, metadata, offset, stripeStart, stripeEnd);
+    }
+    
+    } // unnamed namespace
+    
+    const DecodeKernels KernelsAVX512 = { DecodeStripesAVX512, DecodeStripesHalfResAVX512 };
+    
+    } // namespace detail
+}}
+
+#endif
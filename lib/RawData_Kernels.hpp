@@ -0,0 +1,892 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RawData_Kernels_hpp
+#define RawData_Kernels_hpp
+
+// Bit unpacking kernels of the v7 codec. This header is included by one translation unit per
+// instruction set (RawData.cpp, RawData_AVX2.cpp, RawData_AVX512.cpp) and each of them gets its
+// own copy of the kernels compiled for its target, which is why they live in an unnamed namespace.
+// For the same reason the kernels don't call into std::vector, std::min and the like: those are
+// emitted with external linkage and the linker keeps a single copy for the whole program, which
+// could be the one compiled for AVX.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <simde/x86/sse2.h>
+#include <simde/x86/sse4.1.h>
+
+#if defined(__AVX2__)
+    #include <simde/x86/avx2.h>
+#endif
+
+#if defined(__AVX512BW__)
+    #include <simde/x86/avx512.h>
+#endif
+
+#if defined(__GNUC__)
+#  define INLINE  inline __attribute__((always_inline))
+#  define RESTRICT __restrict__
+#elif defined(_MSC_VER)
+#  define INLINE __forceinline
+#  define RESTRICT __restrict
+#else
+#  define INLINE
+#  define RESTRICT
+#endif
+
+namespace motioncam {
+    namespace raw {
+
+    namespace detail {
+        // Bits and references of an encoded frame, four of each for every column of a stripe
+        struct StripeMetadata {
+            uint32_t encodedWidth;
+            const uint16_t* bits;
+            const uint16_t* refs;
+        };
+
+        // Area of the frame to write out. Pixel (x, y) of the frame lands at
+        // output[(y - y0) * stride + (x - x0)].
+        struct Region {
+            int x0;
+            int y0;
+            int width;
+            int height;
+            size_t stride;
+        };
+
+        // Decodes the 4 row stripes [stripeStart, stripeEnd) starting at offset in the input.
+        // Only the columns covering the region are unpacked, the others are skipped.
+        typedef size_t (*DecodeStripesFunc)(
+            uint16_t* output,
+            const Region& region,
+            const uint8_t* input,
+            const size_t len,
+            const StripeMetadata& metadata,
+            size_t offset,
+            const uint32_t stripeStart,
+            const uint32_t stripeEnd);
+
+        // Kernels for one instruction set
+        struct DecodeKernels {
+            DecodeStripesFunc decodeStripes;
+            DecodeStripesFunc decodeStripesHalfRes;
+        };
+
+        extern const DecodeKernels KernelsAVX2;
+        extern const DecodeKernels KernelsAVX512;
+    }
+
+    namespace {
+    const int ENCODING_BLOCK = 64;
+    const int METADATA_OFFSET = 16;
+
+    constexpr int ENCODING_BLOCK_LENGTH[] = {
+        0,
+        8,
+        16,
+        24,
+        32,
+        40,
+        48,
+        64,
+        64,
+        80,
+        80,
+        128,
+        128,
+        128,
+        128,
+        128,
+        128
+    };
+
+    INLINE
+    size_t EncodedLength(const uint16_t bits) {
+        return ENCODING_BLOCK_LENGTH[bits > 16 ? 16 : bits];
+    }
+
+    template<typename T>
+    INLINE
+    T Min(const T a, const T b) {
+        return b < a ? b : a;
+    }
+
+    template<typename T>
+    INLINE
+    T Max(const T a, const T b) {
+        return a < b ? b : a;
+    }
+
+    //
+    // Vector types. Each lane group of 8 holds one block, so the wider types decode
+    // two (AVX2) or four (AVX-512) consecutive blocks that share the same bit width at once.
+    //
+
+    struct UInt16x8 {
+        static constexpr int BLOCKS = 1;
+
+        simde__m128i d;
+
+        UInt16x8() = default;
+
+        UInt16x8(const simde__m128i& src) : d{ src }
+        {
+        }
+
+        UInt16x8(const uint16_t val) : d{ simde_mm_set1_epi16(val) }
+        {
+        }
+
+        INLINE
+        UInt16x8 operator&(const UInt16x8& rhs) const {
+            return UInt16x8(simde_mm_and_si128(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x8 operator|(const UInt16x8& rhs) const {
+            return UInt16x8(simde_mm_or_si128(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x8 operator<<(const int16_t n) const {
+            simde__m128i shift = simde_mm_set_epi64x(0, n);
+            return UInt16x8(simde_mm_sll_epi16(d, shift));
+        }
+
+        INLINE
+        UInt16x8 operator>>(const int16_t n) const {
+            simde__m128i shift = simde_mm_set_epi64x(0, n);
+            return UInt16x8(simde_mm_srl_epi16(d, shift));
+        }
+
+        // Load 8 bytes and zero-extend to 16 bits per element
+        INLINE
+        static UInt16x8 Load(const uint8_t* src, const size_t /*blockLength*/) {
+            simde__m128i temp = simde_mm_loadl_epi64((const simde__m128i*)src);
+            return UInt16x8(simde_mm_cvtepu8_epi16(temp));
+        }
+
+        // Load 8 16-bit elements
+        INLINE
+        static UInt16x8 Load16(const uint8_t* src, const size_t /*blockLength*/) {
+            return UInt16x8(simde_mm_loadu_si128((const simde__m128i*)src));
+        }
+
+        INLINE
+        void Split(UInt16x8* dst) const {
+            dst[0] = *this;
+        }
+    };
+
+#if defined(__AVX2__)
+    struct UInt16x16 {
+        static constexpr int BLOCKS = 2;
+        typedef UInt16x8 Half;
+
+        simde__m256i d;
+
+        UInt16x16() = default;
+
+        UInt16x16(const simde__m256i& src) : d{ src }
+        {
+        }
+
+        UInt16x16(const uint16_t val) : d{ simde_mm256_set1_epi16(val) }
+        {
+        }
+
+        INLINE
+        UInt16x16 operator&(const UInt16x16& rhs) const {
+            return UInt16x16(simde_mm256_and_si256(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x16 operator|(const UInt16x16& rhs) const {
+            return UInt16x16(simde_mm256_or_si256(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x16 operator<<(const int16_t n) const {
+            return UInt16x16(simde_mm256_sll_epi16(d, simde_mm_set_epi64x(0, n)));
+        }
+
+        INLINE
+        UInt16x16 operator>>(const int16_t n) const {
+            return UInt16x16(simde_mm256_srl_epi16(d, simde_mm_set_epi64x(0, n)));
+        }
+
+        INLINE
+        static UInt16x16 Load(const uint8_t* src, const size_t blockLength) {
+            const simde__m128i a = simde_mm_loadl_epi64((const simde__m128i*)src);
+            const simde__m128i b = simde_mm_loadl_epi64((const simde__m128i*)(src + blockLength));
+
+            return UInt16x16(simde_mm256_cvtepu8_epi16(simde_mm_unpacklo_epi64(a, b)));
+        }
+
+        INLINE
+        static UInt16x16 Load16(const uint8_t* src, const size_t blockLength) {
+            const simde__m128i a = simde_mm_loadu_si128((const simde__m128i*)src);
+            const simde__m128i b = simde_mm_loadu_si128((const simde__m128i*)(src + blockLength));
+
+            return UInt16x16(simde_mm256_inserti128_si256(simde_mm256_castsi128_si256(a), b, 1));
+        }
+
+        // Splits the lanes back into their blocks
+        INLINE
+        void Split(UInt16x8* dst) const {
+            dst[0] = UInt16x8(simde_mm256_castsi256_si128(d));
+            dst[1] = UInt16x8(simde_mm256_extracti128_si256(d, 1));
+        }
+    };
+#endif
+
+#if defined(__AVX512BW__)
+    struct UInt16x32 {
+        static constexpr int BLOCKS = 4;
+        typedef UInt16x16 Half;
+
+        simde__m512i d;
+
+        UInt16x32() = default;
+
+        UInt16x32(const simde__m512i& src) : d{ src }
+        {
+        }
+
+        UInt16x32(const uint16_t val) : d{ simde_mm512_set1_epi16(val) }
+        {
+        }
+
+        INLINE
+        UInt16x32 operator&(const UInt16x32& rhs) const {
+            return UInt16x32(simde_mm512_and_si512(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x32 operator|(const UInt16x32& rhs) const {
+            return UInt16x32(simde_mm512_or_si512(d, rhs.d));
+        }
+
+        INLINE
+        UInt16x32 operator<<(const int16_t n) const {
+            return UInt16x32(simde_mm512_sll_epi16(d, simde_mm_set_epi64x(0, n)));
+        }
+
+        INLINE
+        UInt16x32 operator>>(const int16_t n) const {
+            return UInt16x32(simde_mm512_srl_epi16(d, simde_mm_set_epi64x(0, n)));
+        }
+
+        INLINE
+        static UInt16x32 Load(const uint8_t* src, const size_t blockLength) {
+            const simde__m128i a = simde_mm_loadl_epi64((const simde__m128i*)src);
+            const simde__m128i b = simde_mm_loadl_epi64((const simde__m128i*)(src + blockLength));
+            const simde__m128i c = simde_mm_loadl_epi64((const simde__m128i*)(src + 2*blockLength));
+            const simde__m128i e = simde_mm_loadl_epi64((const simde__m128i*)(src + 3*blockLength));
+
+            const simde__m256i lo = simde_mm256_cvtepu8_epi16(simde_mm_unpacklo_epi64(a, b));
+            const simde__m256i hi = simde_mm256_cvtepu8_epi16(simde_mm_unpacklo_epi64(c, e));
+
+            return UInt16x32(simde_mm512_inserti64x4(simde_mm512_castsi256_si512(lo), hi, 1));
+        }
+
+        INLINE
+        static UInt16x32 Load16(const uint8_t* src, const size_t blockLength) {
+            simde__m512i v = simde_mm512_castsi128_si512(simde_mm_loadu_si128((const simde__m128i*)src));
+
+            v = simde_mm512_inserti32x4(v, simde_mm_loadu_si128((const simde__m128i*)(src + blockLength)), 1);
+            v = simde_mm512_inserti32x4(v, simde_mm_loadu_si128((const simde__m128i*)(src + 2*blockLength)), 2);
+            v = simde_mm512_inserti32x4(v, simde_mm_loadu_si128((const simde__m128i*)(src + 3*blockLength)), 3);
+
+            return UInt16x32(v);
+        }
+
+        // Splits the lanes back into their blocks
+        INLINE
+        void Split(UInt16x8* dst) const {
+            dst[0] = UInt16x8(simde_mm512_extracti32x4_epi32(d, 0));
+            dst[1] = UInt16x8(simde_mm512_extracti32x4_epi32(d, 1));
+            dst[2] = UInt16x8(simde_mm512_extracti32x4_epi32(d, 2));
+            dst[3] = UInt16x8(simde_mm512_extracti32x4_epi32(d, 3));
+        }
+    };
+#endif
+
+    //
+    // Kernels. Every kernel unpacks a 64 pixel block into r[0..7], r[k] holding pixels 8k..8k+7.
+    //
+
+    template<typename T>
+    INLINE
+    void Decode1(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[1];
+        const T N(0x01);
+        const T p = T::Load(input, L);
+
+        r[0] =  p & N;
+        r[1] = (p & (N << 1)) >> 1;
+        r[2] = (p & (N << 2)) >> 2;
+        r[3] = (p & (N << 3)) >> 3;
+        r[4] = (p & (N << 4)) >> 4;
+        r[5] = (p & (N << 5)) >> 5;
+        r[6] = (p & (N << 6)) >> 6;
+        r[7] = (p & (N << 7)) >> 7;
+    }
+
+    template<typename T>
+    INLINE
+    void Decode2_One(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[2];
+        const T N(0x03);
+        const T p = T::Load(input, L);
+
+        r[0] =  p & N;
+        r[1] = (p & (N << 2)) >> 2;
+        r[2] = (p & (N << 4)) >> 4;
+        r[3] = (p & (N << 6)) >> 6;
+    }
+
+    template<typename T>
+    INLINE
+    void Decode2(T* r, const uint8_t* input) {
+        Decode2_One<T>(r, input);
+        Decode2_One<T>(r + 4, input + 8);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode3(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[3];
+        const T N(0x07);
+        const T U(0x03);
+        const T R(0x01);
+
+        const T p0 = T::Load(input, L);
+        const T p1 = T::Load(input+8, L);
+        const T p2 = T::Load(input+16, L);
+
+        const T _r2 = (p0 & (U << 6)) >> 6;
+        const T _r5 = (p1 & (U << 6)) >> 6;
+
+        r[0] =  p0 & N;
+        r[1] = (p0 & (N << 3)) >> 3;
+        r[3] =  p1 & N;
+        r[4] = (p1 & (N << 3)) >> 3;
+        r[6] =  p2 & N;
+        r[7] = (p2 & (N << 3)) >> 3;
+
+        // Restore upper bits
+        r[2] = _r2 | (((p2 >> 6) & R) << 2);
+        r[5] = _r5 | (((p2 >> 7) & R) << 2);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode4_One(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[4];
+        const T N(0x0F);
+        const T p = T::Load(input, L);
+
+        r[0] =  p & N;
+        r[1] = (p & (N << 4)) >> 4;
+    }
+
+    template<typename T>
+    INLINE
+    void Decode4(T* r, const uint8_t* input) {
+        Decode4_One<T>(r,     input);
+        Decode4_One<T>(r + 2, input + 8);
+        Decode4_One<T>(r + 4, input + 16);
+        Decode4_One<T>(r + 6, input + 24);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode5(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[5];
+        const T N(0x1F);
+        const T M(0x07);
+        const T U(0x03);
+        const T F(0x01);
+
+        const T p0 = T::Load(input, L);
+        const T p1 = T::Load(input+8, L);
+        const T p2 = T::Load(input+16, L);
+        const T p3 = T::Load(input+24, L);
+        const T p4 = T::Load(input+32, L);
+
+        r[0] =  p0 & N;
+        r[1] =  p1 & N;
+        r[2] =  p2 & N;
+        r[3] =  p3 & N;
+        r[4] =  p4 & N;
+
+        r[5] = ((p0 >> 5) & M) | (((p3 >> 5) & U) << 3);
+        r[6] = ((p1 >> 5) & M) | (((p4 >> 5) & U) << 3);
+
+        const T tmp0 = (p2 >> 5) & M;
+        const T tmp1 = tmp0 | ((p3 >> 7) & F) << 3;
+
+        r[7] = tmp1 | ((p4 >> 7) & F) << 4;
+    }
+
+    template<typename T>
+    INLINE
+    void Decode6(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[6];
+        const T N(0x3F);
+        const T U(0x03);
+
+        const T p0 = T::Load(input, L);
+        const T p1 = T::Load(input+8, L);
+        const T p2 = T::Load(input+16, L);
+        const T p3 = T::Load(input+24, L);
+        const T p4 = T::Load(input+32, L);
+        const T p5 = T::Load(input+40, L);
+
+        r[0] =  p0 & N;
+        r[1] =  p1 & N;
+        r[2] =  p2 & N;
+        r[3] =  p3 & N;
+        r[4] =  p4 & N;
+        r[5] =  p5 & N;
+
+        r[6] =
+               ((p0 >> 6) & U)
+            | (((p1 >> 6) & U) << 2)
+            | (((p2 >> 6) & U) << 4);
+
+        r[7] =
+               ((p3 >> 6) & U)
+            | (((p4 >> 6) & U) << 2)
+            | (((p5 >> 6) & U) << 4);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode8(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[8];
+
+        r[0] = T::Load(input, L);
+        r[1] = T::Load(input + 8, L);
+        r[2] = T::Load(input + 16, L);
+        r[3] = T::Load(input + 24, L);
+        r[4] = T::Load(input + 32, L);
+        r[5] = T::Load(input + 40, L);
+        r[6] = T::Load(input + 48, L);
+        r[7] = T::Load(input + 56, L);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode10(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[10];
+        const T N(0xFF);
+        const T U(0x03);
+
+        const T p0 = T::Load(input, L);
+        const T p1 = T::Load(input+8, L);
+        const T p2 = T::Load(input+16, L);
+        const T p3 = T::Load(input+24, L);
+        const T p4 = T::Load(input+32, L);
+        const T p5 = T::Load(input+40, L);
+        const T p6 = T::Load(input+48, L);
+        const T p7 = T::Load(input+56, L);
+        const T p8 = T::Load(input+64, L);
+        const T p9 = T::Load(input+72, L);
+
+        r[0] = (p0 & N) | ((p4 & U)          << 8);
+        r[1] = (p1 & N) | ((p4 & (U << 2))   << 6);
+        r[2] = (p2 & N) | ((p4 & (U << 4))   << 4);
+        r[3] = (p3 & N) | ((p4 & (U << 6))   << 2);
+
+        r[4] = (p5 & N) | ((p9 & U)          << 8);
+        r[5] = (p6 & N) | ((p9 & (U << 2))   << 6);
+        r[6] = (p7 & N) | ((p9 & (U << 4))   << 4);
+        r[7] = (p8 & N) | ((p9 & (U << 6))   << 2);
+    }
+
+    template<typename T>
+    INLINE
+    void Decode16(T* r, const uint8_t* input) {
+        const size_t L = ENCODING_BLOCK_LENGTH[16];
+
+        r[0] = T::Load16(input, L);
+        r[1] = T::Load16(input + 16, L);
+        r[2] = T::Load16(input + 32, L);
+        r[3] = T::Load16(input + 48, L);
+        r[4] = T::Load16(input + 64, L);
+        r[5] = T::Load16(input + 80, L);
+        r[6] = T::Load16(input + 96, L);
+        r[7] = T::Load16(input + 112, L);
+    }
+
+    // Unpacks T::BLOCKS consecutive blocks that are all encoded with the same number of bits
+    template<typename T>
+    INLINE
+    void UnpackBlocks(T* r, const uint16_t bits, const uint8_t* input) {
+        switch (bits) {
+            case 0:
+                for(int i = 0; i < 8; i++)
+                    r[i] = T(0);
+                break;
+            case 1:
+                Decode1<T>(r, input);
+                break;
+            case 2:
+                Decode2<T>(r, input);
+                break;
+            case 3:
+                Decode3<T>(r, input);
+                break;
+            case 4:
+                Decode4<T>(r, input);
+                break;
+            case 5:
+                Decode5<T>(r, input);
+                break;
+            case 6:
+                Decode6<T>(r, input);
+                break;
+            case 7:
+            case 8:
+                Decode8<T>(r, input);
+                break;
+            case 9:
+            case 10:
+                Decode10<T>(r, input);
+                break;
+            default:
+            case 16:
+                Decode16<T>(r, input);
+                break;
+        }
+    }
+
+    // Hands out the unpacked registers per block, p[k][i] holding pixels 8i..8i+7 of block k
+    template<typename T>
+    INLINE
+    void SplitBlocks(UInt16x8 (*p)[8], const T* r) {
+        UInt16x8 parts[T::BLOCKS];
+
+        for(int i = 0; i < 8; i++) {
+            r[i].Split(parts);
+
+            for(int k = 0; k < T::BLOCKS; k++)
+                p[k][i] = parts[k];
+        }
+    }
+
+    INLINE
+    size_t DecodeBlock(
+        UInt16x8* p,
+        const uint16_t bits,
+        const uint8_t* input,
+        const size_t offset,
+        const size_t len)
+    {
+        const size_t blockLength = EncodedLength(bits);
+
+        // Don't decode if past end of input
+        if(offset + blockLength > len) {
+            for(int i = 0; i < 8; i++)
+                p[i] = UInt16x8(static_cast<uint16_t>(0));
+
+            return len - offset;
+        }
+
+        UnpackBlocks<UInt16x8>(p, bits, input + offset);
+
+        return blockLength;
+    }
+
+    // Decodes the four blocks of one column of a stripe into p[0..3], returns the new offset
+    template<typename T>
+    INLINE
+    size_t DecodeColumn(
+        UInt16x8 (*p)[8],
+        const uint16_t* bits,
+        const uint8_t* input,
+        size_t offset,
+        const size_t len)
+    {
+        if constexpr (T::BLOCKS == 4) {
+            if(bits[0] == bits[1] && bits[0] == bits[2] && bits[0] == bits[3]) {
+                const size_t blockLength = EncodedLength(bits[0]);
+
+                if(offset + 4*blockLength <= len) {
+                    T r[8];
+
+                    UnpackBlocks<T>(r, bits[0], input + offset);
+                    SplitBlocks<T>(p, r);
+
+                    return offset + 4*blockLength;
+                }
+            }
+
+            return DecodeColumn<typename T::Half>(p, bits, input, offset, len);
+        }
+        else if constexpr (T::BLOCKS == 2) {
+            for(int i = 0; i < 4; i += 2) {
+                const size_t blockLength = EncodedLength(bits[i]);
+
+                if(bits[i] == bits[i+1] && offset + 2*blockLength <= len) {
+                    T r[8];
+
+                    UnpackBlocks<T>(r, bits[i], input + offset);
+                    SplitBlocks<T>(p + i, r);
+
+                    offset += 2*blockLength;
+                }
+                else {
+                    offset += DecodeBlock(p[i], bits[i], input, offset, len);
+                    offset += DecodeBlock(p[i+1], bits[i+1], input, offset, len);
+                }
+            }
+
+            return offset;
+        }
+        else {
+            for(int i = 0; i < 4; i++)
+                offset += DecodeBlock(p[i], bits[i], input, offset, len);
+
+            return offset;
+        }
+    }
+
+    // Adds the references and interleaves half a block from each of a and b into 64 consecutive pixels of a row
+    INLINE
+    void InterleaveRow(
+        uint16_t* RESTRICT dst,
+        const UInt16x8* a,
+        const UInt16x8* b,
+        const simde__m128i refA,
+        const simde__m128i refB)
+    {
+        for(int i = 0; i < 4; i++) {
+            const simde__m128i va = simde_mm_add_epi16(a[i].d, refA);
+            const simde__m128i vb = simde_mm_add_epi16(b[i].d, refB);
+
+            simde_mm_storeu_si128((simde__m128i*)(dst + 16*i), simde_mm_unpacklo_epi16(va, vb));
+            simde_mm_storeu_si128((simde__m128i*)(dst + 16*i + 8), simde_mm_unpackhi_epi16(va, vb));
+        }
+    }
+
+    template<typename T>
+    size_t DecodeStripes(
+        uint16_t* output,
+        const detail::Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const detail::StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        const int encodedWidth = static_cast<int>(metadata.encodedWidth);
+        const uint16_t* bits = metadata.bits;
+        const uint16_t* refs = metadata.refs;
+
+        const int xStart = region.x0;
+        const int xEnd = region.x0 + region.width;
+
+        // Used for columns that straddle the edges of the region
+        uint16_t tail[4*ENCODING_BLOCK];
+
+        size_t metadataIdx = static_cast<size_t>(stripeStart) * (encodedWidth / ENCODING_BLOCK) * 4;
+        size_t written = 0;
+
+        for(uint32_t stripe = stripeStart; stripe < stripeEnd; stripe++) {
+            const int y = static_cast<int>(stripe) * 4;
+            uint16_t* rows[4];
+
+            for(int i = 0; i < 4; i++) {
+                const int row = y + i - region.y0;
+
+                rows[i] = (row >= 0 && row < region.height) ? output + static_cast<size_t>(row) * region.stride : nullptr;
+                if(rows[i])
+                    written += region.width;
+            }
+
+            for(int x = 0; x < encodedWidth; x += ENCODING_BLOCK) {
+                // Step over columns outside of the region without unpacking them
+                if(x + ENCODING_BLOCK <= xStart || x >= xEnd) {
+                    size_t skip = 0;
+                    for(int i = 0; i < 4; i++)
+                        skip += EncodedLength(bits[metadataIdx + i]);
+
+                    offset = Min(offset + skip, len);
+                    metadataIdx += 4;
+                    continue;
+                }
+
+                UInt16x8 p[4][8];
+
+                offset = DecodeColumn<T>(p, bits + metadataIdx, input, offset, len);
+
+                const bool partial = x < xStart || x + ENCODING_BLOCK > xEnd;
+                uint16_t* dst[4];
+
+                for(int i = 0; i < 4; i++)
+                    dst[i] = (rows[i] && !partial) ? rows[i] + (x - xStart) : tail + i*ENCODING_BLOCK;
+
+                const simde__m128i ref0 = simde_mm_set1_epi16(refs[metadataIdx]);
+                const simde__m128i ref1 = simde_mm_set1_epi16(refs[metadataIdx+1]);
+                const simde__m128i ref2 = simde_mm_set1_epi16(refs[metadataIdx+2]);
+                const simde__m128i ref3 = simde_mm_set1_epi16(refs[metadataIdx+3]);
+
+                // First half of each block goes to the top two rows, second half to the bottom two
+                InterleaveRow(dst[0], p[0],     p[1],     ref0, ref1);
+                InterleaveRow(dst[1], p[2],     p[3],     ref2, ref3);
+                InterleaveRow(dst[2], p[0] + 4, p[1] + 4, ref0, ref1);
+                InterleaveRow(dst[3], p[2] + 4, p[3] + 4, ref2, ref3);
+
+                if(partial) {
+                    const int from = Max(x, xStart);
+                    const int to = Min(x + ENCODING_BLOCK, xEnd);
+
+                    for(int i = 0; i < 4; i++) {
+                        if(rows[i])
+                            std::memcpy(rows[i] + (from - xStart), tail + i*ENCODING_BLOCK + (from - x), (to - from) * 2);
+                    }
+                }
+
+                metadataIdx += 4;
+            }
+        }
+
+        return written;
+    }
+
+    // Stores the two halves of a block, with the reference added, to consecutive rows of a plane
+    INLINE
+    void StorePlaneRows(
+        uint16_t* RESTRICT top,
+        uint16_t* RESTRICT bottom,
+        const UInt16x8* p,
+        const simde__m128i ref)
+    {
+        for(int i = 0; i < 4; i++) {
+            simde_mm_storeu_si128((simde__m128i*)(top + 8*i), simde_mm_add_epi16(p[i].d, ref));
+            simde_mm_storeu_si128((simde__m128i*)(bottom + 8*i), simde_mm_add_epi16(p[4+i].d, ref));
+        }
+    }
+
+    // Same as DecodeStripes but writes each of the four blocks of a column to its own plane, region being
+    // in half resolution coordinates. Plane k starts at output + k * stride * region.height.
+    template<typename T>
+    size_t DecodeStripesHalfRes(
+        uint16_t* output,
+        const detail::Region& region,
+        const uint8_t* input,
+        const size_t len,
+        const detail::StripeMetadata& metadata,
+        size_t offset,
+        const uint32_t stripeStart,
+        const uint32_t stripeEnd)
+    {
+        const int HALF_BLOCK = ENCODING_BLOCK / 2;
+
+        const int encodedWidth = static_cast<int>(metadata.encodedWidth);
+        const uint16_t* bits = metadata.bits;
+        const uint16_t* refs = metadata.refs;
+
+        const size_t planeSize = region.stride * region.height;
+        const int xStart = region.x0;
+        const int xEnd = region.x0 + region.width;
+
+        // Used for columns that straddle the edges of the region
+        uint16_t tail[4*ENCODING_BLOCK];
+
+        size_t metadataIdx = static_cast<size_t>(stripeStart) * (encodedWidth / ENCODING_BLOCK) * 4;
+        size_t written = 0;
+
+        for(uint32_t stripe = stripeStart; stripe < stripeEnd; stripe++) {
+            const int y = static_cast<int>(stripe) * 2;
+            uint16_t* rows[2];
+
+            for(int i = 0; i < 2; i++) {
+                const int row = y + i - region.y0;
+
+                rows[i] = (row >= 0 && row < region.height) ? output + static_cast<size_t>(row) * region.stride : nullptr;
+                if(rows[i])
+                    written += 4 * region.width;
+            }
+
+            for(int x = 0; x < encodedWidth / 2; x += HALF_BLOCK) {
+                // Step over columns outside of the region without unpacking them
+                if(x + HALF_BLOCK <= xStart || x >= xEnd) {
+                    size_t skip = 0;
+                    for(int i = 0; i < 4; i++)
+                        skip += EncodedLength(bits[metadataIdx + i]);
+
+                    offset = Min(offset + skip, len);
+                    metadataIdx += 4;
+                    continue;
+                }
+
+                UInt16x8 p[4][8];
+
+                offset = DecodeColumn<T>(p, bits + metadataIdx, input, offset, len);
+
+                const bool partial = x < xStart || x + HALF_BLOCK > xEnd;
+
+                for(int k = 0; k < 4; k++) {
+                    const simde__m128i ref = simde_mm_set1_epi16(refs[metadataIdx + k]);
+
+                    uint16_t* top = tail + 2*k*HALF_BLOCK;
+                    uint16_t* bottom = top + HALF_BLOCK;
+
+                    if(!partial) {
+                        if(rows[0])
+                            top = rows[0] + k*planeSize + (x - xStart);
+                        if(rows[1])
+                            bottom = rows[1] + k*planeSize + (x - xStart);
+                    }
+
+                    StorePlaneRows(top, bottom, p[k], ref);
+                }
+
+                if(partial) {
+                    const int from = Max(x, xStart);
+                    const int to = Min(x + HALF_BLOCK, xEnd);
+
+                    for(int k = 0; k < 4; k++) {
+                        for(int i = 0; i < 2; i++) {
+                            if(rows[i])
+                                std::memcpy(
+                                    rows[i] + k*planeSize + (from - xStart),
+                                    tail + (2*k + i)*HALF_BLOCK + (from - x),
+                                    (to - from) * 2);
+                        }
+                    }
+                }
+
+                metadataIdx += 4;
+            }
+        }
+
+        return written;
+    }
+
+    } // unnamed namespace
+}}
+
+#endif /* RawData_Kernels_hpp */
@@ -1,4 +1,8 @@
 #include <motioncam/RawData.hpp>
+#include <motioncam/ThreadPool.hpp>
+
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 namespace motioncam {
@@ -440,22 +444,17 @@ namespace motioncam {
 
         return HEADER_LENGTH + ENCODING_BLOCK_LENGTH[bits];
     }
-    } // anonymous namespace
-
-    size_t DecodeLegacy(uint16_t* output, const int width, const int height, const uint8_t* input, const size_t len) {
-        uint16_t* outputStart = output;
+    
+    void ReadDecodeOffsets(const uint8_t* input, const size_t len, std::vector<uint32_t>& decodeOffsets) {
+        decodeOffsets.clear();
         
-        // Account for padding at the end
-        const int paddedWidth = GetPaddedWidth(width);
-
-        // Get decoding offset blocks if available
-        std::vector<uint32_t> decodeOffsets;
-        decodeOffsets.reserve(5);
+        if(len < 1)
+            return;
         
         uint8_t marker = input[len - 1];
         size_t decodeOffset = len - 1;
         
-        while(marker == 0xFF) {
+        while(marker == 0xFF && decodeOffset >= 5) {
             uint32_t pos =
                 ((uint32_t) input[decodeOffset-4] << 24) |
                 ((uint32_t) input[decodeOffset-3] << 16) |
@@ -467,15 +466,59 @@ namespace motioncam {
             decodeOffset -= 5;
             marker = input[decodeOffset];
         }
-
-
+    }
+    
+    // Steps over numRows rows starting at offset by reading only the block headers, returns the offset following
+    // the last row the same way DecodeRows would
+    size_t SkipRows(
+        const int width,
+        const uint8_t* input,
+        const size_t len,
+        size_t offset,
+        const int numRows)
+    {
+        // Each row is made up of two blocks for every encoding block of its padded width
+        const int blocksPerRow = GetPaddedWidth(width) / BLOCK_SIZE;
+        
+        for(int y = 0; y < numRows; y++) {
+            for(int i = 0; i < blocksPerRow; i++) {
+                if(offset + HEADER_LENGTH >= len)
+                    return len;
+                
+                const uint8_t bits = (input[offset] >> 4) & 0x0F;
+                const size_t next = offset + HEADER_LENGTH + ENCODING_BLOCK_LENGTH[bits];
+                
+                if(next >= len)
+                    return len;
+                
+                offset = next;
+            }
+        }
+        
+        return offset;
+    }
+    
+    // Decodes rows [yStart, yEnd) starting at offset, returns the offset following the last row
+    size_t DecodeRows(
+        uint16_t* output,
+        const size_t stride,
+        const int width,
+        const uint8_t* input,
+        const size_t len,
+        size_t offset,
+        const int yStart,
+        const int yEnd)
+    {
+        // Account for padding at the end
+        const int paddedWidth = GetPaddedWidth(width);
+        
         std::vector<uint16_t> row(paddedWidth);
         uint16_t reference0, reference1;
         uint16_t p[ENCODING_BLOCK];
+        
+        output += static_cast<size_t>(yStart) * stride;
 
-        size_t offset = 0;
-
-        for(int y = 0; y < height; y++) {
+        for(int y = yStart; y < yEnd; y++) {
             for(int x = 0; x < paddedWidth; x += ENCODING_BLOCK) {
                 offset += DecodeBlock(&p[0], reference0, input, offset, len);
                 offset += DecodeBlock(&p[16], reference1, input, offset, len);
@@ -488,10 +531,95 @@ namespace motioncam {
 
             // Skip padded garbage at the ned
             std::memcpy(output, row.data(), width * 2);
-            output += width;
+            output += stride;
+        }
+        
+        return offset;
+    }
+    } // anonymous namespace
+
+    size_t DecodeLegacy(uint16_t* output, const int width, const int height, const uint8_t* input, const size_t len) {
+        DecodeRows(output, width, width, input, len, 0, 0, height);
+        
+        return static_cast<size_t>(width) * height;
+    }
+    
+    size_t DecodeLegacyParallel(
+        uint16_t* output,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        return DecodeLegacyParallel(output, width, width, height, input, len, threadCount);
+    }
+    
+    size_t DecodeLegacyParallel(
+        uint16_t* output,
+        const size_t stride,
+        const int width,
+        const int height,
+        const uint8_t* input,
+        const size_t len,
+        const int threadCount)
+    {
+        if(stride < static_cast<size_t>(width))
+            return 0;
+        
+
+        // Get decoding offset blocks if available
+        std::vector<uint32_t> decodeOffsets;
+        
+        ReadDecodeOffsets(input, len, decodeOffsets);
+        
+        // The encoder splits the image into runs of height / numSegments rows, the first one starting at zero and the
+        // last one taking the remaining rows
+        decodeOffsets.push_back(0);
+        
+        std::sort(decodeOffsets.begin(), decodeOffsets.end());
+        decodeOffsets.erase(std::unique(decodeOffsets.begin(), decodeOffsets.end()), decodeOffsets.end());
+        
+        const int numSegments = static_cast<int>(decodeOffsets.size());
+        
+        if(threadCount <= 1 || numSegments <= 1 || numSegments > height || decodeOffsets.back() >= len) {
+            DecodeRows(output, stride, width, input, len, 0, 0, height);
+            return static_cast<size_t>(width) * height;
         }
         
-        return (output - outputStart);
+        const int rowsPerSegment = height / numSegments;
+        const int numTasks = std::min(threadCount, numSegments);
+        
+        // Check every segment ends where the next one starts before decoding anything, stepping over the block
+        // headers is much cheaper than unpacking the blocks
+        std::vector<char> splitMatches(numSegments, 1);
+        
+        ThreadPool::shared().parallelFor(numTasks, [&](int task) {
+            const int first = (numSegments * task) / numTasks;
+            const int last = std::min((numSegments * (task + 1)) / numTasks, numSegments - 1);
+            
+            for(int i = first; i < last; i++)
+                splitMatches[i] = SkipRows(width, input, len, decodeOffsets[i], rowsPerSegment) == decodeOffsets[i + 1];
+        });
+        
+        if(std::find(splitMatches.begin(), splitMatches.end(), 0) != splitMatches.end()) {
+            DecodeRows(output, stride, width, input, len, 0, 0, height);
+            return static_cast<size_t>(width) * height;
+        }
+        
+        ThreadPool::shared().parallelFor(numTasks, [&](int task) {
+            const int first = (numSegments * task) / numTasks;
+            const int last = (numSegments * (task + 1)) / numTasks;
+            
+            for(int i = first; i < last; i++) {
+                const int yStart = i * rowsPerSegment;
+                const int yEnd = (i == numSegments - 1) ? height : yStart + rowsPerSegment;
+                
+                DecodeRows(output, stride, width, input, len, decodeOffsets[i], yStart, yEnd);
+            }
+        });
+        
+        return static_cast<size_t>(width) * height;
     }
     
 }} // namespace
@@ -0,0 +1,123 @@
+#include <motioncam/ThreadPool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace motioncam {
+    namespace {
+        struct ParallelForState {
+            std::atomic<int> next{0};
+            std::atomic<int> done{0};
+            std::mutex lock;
+            std::condition_variable finished;
+            std::exception_ptr error;
+        };
+    
+        void runIndices(ParallelForState& state, const int count, const std::function<void(int)>& fn) {
+            int i;
+            
+            while((i = state.next.fetch_add(1)) < count) {
+                try {
+                    fn(i);
+                }
+                catch(...) {
+                    std::lock_guard<std::mutex> lock(state.lock);
+                    if(!state.error)
+                        state.error = std::current_exception();
+                }
+                
+                if(state.done.fetch_add(1) + 1 == count) {
+                    std::lock_guard<std::mutex> lock(state.lock);
+                    state.finished.notify_all();
+                }
+            }
+        }
+    }
+    
+    ThreadPool::ThreadPool(const unsigned int numThreads) : mStop(false) {
+        const unsigned int n = std::max(1u, numThreads);
+        
+        mThreads.reserve(n);
+        for(unsigned int i = 0; i < n; i++)
+            mThreads.emplace_back(&ThreadPool::run, this);
+    }
+    
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStop = true;
+        }
+        
+        mCondition.notify_all();
+        
+        for(auto& t : mThreads)
+            t.join();
+    }
+    
+    unsigned int ThreadPool::size() const {
+        return static_cast<unsigned int>(mThreads.size());
+    }
+    
+    void ThreadPool::submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mTasks.push_back(std::move(task));
+        }
+        
+        mCondition.notify_one();
+    }
+    
+    void ThreadPool::parallelFor(const int count, const std::function<void(int)>& fn) {
+        if(count <= 0)
+            return;
+        
+        // Helpers that start after all indices are taken return without touching fn, so the
+        // state is shared with them rather than living on this stack frame.
+        auto state = std::make_shared<ParallelForState>();
+        const int numHelpers = std::min(count - 1, static_cast<int>(size()));
+        
+        for(int i = 0; i < numHelpers; i++) {
+            submit([state, count, &fn]() {
+                runIndices(*state, count, fn);
+            });
+        }
+        
+        // The calling thread works too, so this never waits on a queue that is blocked
+        runIndices(*state, count, fn);
+        
+        {
+            std::unique_lock<std::mutex> lock(state->lock);
+            state->finished.wait(lock, [&]() { return state->done.load() == count; });
+        }
+        
+        if(state->error)
+            std::rethrow_exception(state->error);
+    }
+    
+    ThreadPool& ThreadPool::shared() {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+    
+    void ThreadPool::run() {
+        while(true) {
+            std::function<void()> task;
+            
+            {
+                std::unique_lock<std::mutex> lock(mLock);
+                mCondition.wait(lock, [this]() { return mStop || !mTasks.empty(); });
+                
+                if(mStop && mTasks.empty())
+                    return;
+                
+                task = std::move(mTasks.front());
+                mTasks.pop_front();
+            }
+            
+            task();
+        }
+    }
+    
+} // namespace motioncam
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BufferPool_hpp
+#define BufferPool_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace motioncam {
+    class BufferPool;
+    
+    // A block of memory borrowed from a BufferPool, handed back to the pool when destroyed.
+    // The contents are not initialised.
+    class PooledBuffer {
+    public:
+        PooledBuffer();
+        PooledBuffer(PooledBuffer&& other) noexcept;
+        PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+        ~PooledBuffer();
+        
+        PooledBuffer(const PooledBuffer&) = delete;
+        PooledBuffer& operator=(const PooledBuffer&) = delete;
+        
+        uint8_t* data() { return mData.get(); }
+        const uint8_t* data() const { return mData.get(); }
+        
+        template<typename T>
+        T* as() { return reinterpret_cast<T*>(mData.get()); }
+        
+        template<typename T>
+        const T* as() const { return reinterpret_cast<const T*>(mData.get()); }
+        
+        // Bytes requested when the buffer was acquired
+        size_t size() const { return mSize; }
+        
+        // Bytes usable, at least size()
+        size_t capacity() const { return mCapacity; }
+        
+        bool empty() const { return mSize == 0; }
+        
+        // Hand the memory back to the pool early
+        void reset();
+        
+    private:
+        friend class BufferPool;
+        
+        PooledBuffer(BufferPool* pool, std::unique_ptr<uint8_t[]> data, size_t size, size_t capacity);
+        
+    private:
+        BufferPool* mPool;
+        std::unique_ptr<uint8_t[]> mData;
+        size_t mSize;
+        size_t mCapacity;
+    };
+    
+    // Keeps released buffers around, grouped by size class, so that repeatedly acquiring buffers of
+    // similar sizes does not go back to the heap. Size classes are spaced a quarter of a power of two
+    // apart so no more than 25% of a buffer is wasted.
+    class BufferPool {
+    public:
+        struct Stats {
+            uint64_t allocations;   // Buffers that had to come from the heap
+            uint64_t hits;          // Buffers reused from the pool
+            size_t bytesPooled;     // Bytes currently held by the pool, not including buffers in use
+        };
+        
+        // At most maxPooledBytes are kept around, anything over is freed on release
+        BufferPool(const size_t maxPooledBytes);
+        
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        
+        // Get a buffer of at least size bytes
+        PooledBuffer acquire(const size_t size);
+        
+        // Free all pooled buffers
+        void clear();
+        
+        Stats stats() const;
+        
+        // Process wide pool
+        static BufferPool& shared();
+        
+    private:
+        friend class PooledBuffer;
+        
+        void release(std::unique_ptr<uint8_t[]> data, const size_t capacity);
+        
+    private:
+        const size_t mMaxPooledBytes;
+        std::map<size_t, std::vector<std::unique_ptr<uint8_t[]>>> mBuffers;
+        size_t mBytesPooled;
+        uint64_t mAllocations;
+        uint64_t mHits;
+        mutable std::mutex mLock;
+    };
+} // namespace motioncam
+
+#endif /* BufferPool_hpp */
@@ -17,17 +17,37 @@
 #ifndef Decoder_hpp
 #define Decoder_hpp
 
+#include <motioncam/BufferPool.hpp>
 #include <motioncam/Container.hpp>
 #include <nlohmann/json.hpp>
 
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
 
 namespace motioncam {
     typedef int64_t Timestamp;
     typedef std::pair<Timestamp, std::vector<int16_t>> AudioChunk;
 
+    // Values of FrameInfo::compressionType
+    constexpr int MOTIONCAM_COMPRESSION_TYPE_LEGACY = 6;
+    constexpr int MOTIONCAM_COMPRESSION_TYPE = 7;
+
+    // Non-owning view into bytes held by a Decoder
+    struct BufferView {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    struct FrameInfo {
+        int width = 0;
+        int height = 0;
+        int compressionType = 0;
+        nlohmann::json metadata;
+    };
+
     class MotionCamException : public std::runtime_error {
     public:
         MotionCamException(const std::string& error) : runtime_error(error) {}
@@ -45,7 +65,7 @@ namespace motioncam {
     
     class Decoder {
     public:
-        Decoder(const std::string& path);
+        Decoder(const std::string& path, const bool memoryMap=false);
         Decoder(FILE* file);
         
         ~Decoder();
@@ -56,8 +76,70 @@ namespace motioncam {
         // Get all frame timestamps in container
         const std::vector<Timestamp>& getFrames() const;
         
-        // Load a single frame and its metadata.
-        void loadFrame(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata);
+        // Load a single frame and its metadata. Safe to call from multiple threads at once. Passing the same outData for
+        // every frame lets it be decoded into directly, a vector that has to grow is filled with a copy instead.
+        void loadFrame(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata) const;
+        
+        // Same as above but reads the compressed frame into a caller owned scratch buffer.
+        void loadFrame(
+            const Timestamp timestamp,
+            std::vector<uint16_t>& outData,
+            nlohmann::json& outMetadata,
+            std::vector<uint8_t>& scratch) const;
+        
+        // Decode a frame into a buffer from the shared BufferPool, holding width * height pixels
+        void loadFrame(const Timestamp timestamp, PooledBuffer& outData, FrameInfo& outInfo) const;
+        
+        // Decode a frame into caller owned memory, rows of dst being dstStride pixels apart. dst must hold
+        // height rows of at least width pixels, use getFrameInfo() to find the size of a frame beforehand.
+        void loadFrame(const Timestamp timestamp, uint16_t* dst, const size_t dstStride, FrameInfo& outInfo) const;
+        
+        // Decode rows [rowStart, rowStart + rowCount) of a frame into dst, rows of dst being dstStride pixels apart.
+        // Only the stripes covering the rows are decoded, except for legacy frames which are decoded in full and copied.
+        void loadFrameRows(
+            const Timestamp timestamp,
+            const int rowStart,
+            const int rowCount,
+            uint16_t* dst,
+            const size_t dstStride,
+            FrameInfo& outInfo) const;
+        
+        // Same as above for a frame whose info was already read with getFrameInfo(). Only its width, height and
+        // compression type are used, the frame's metadata isn't read or parsed again.
+        void loadFrameRows(
+            const Timestamp timestamp,
+            const FrameInfo& info,
+            const int rowStart,
+            const int rowCount,
+            uint16_t* dst,
+            const size_t dstStride) const;
+        
+        // Read the dimensions and metadata of a frame without decoding it
+        void getFrameInfo(const Timestamp timestamp, FrameInfo& outInfo) const;
+        
+        // Load the regionWidth x regionHeight area at (x0, y0) of a frame. outMetadata describes the full frame.
+        void loadFrameRegion(
+            const Timestamp timestamp,
+            const int x0,
+            const int y0,
+            const int regionWidth,
+            const int regionHeight,
+            std::vector<uint16_t>& outData,
+            nlohmann::json& outMetadata) const;
+        
+        // Load a frame at half resolution as four (width/2) x (height/2) planes, one per colour filter position.
+        // See raw::DecodeHalfRes for the layout. outMetadata describes the full frame.
+        void loadFrameProxy(const Timestamp timestamp, std::vector<uint16_t>& outData, nlohmann::json& outMetadata) const;
+        
+        // Number of threads used to decode a single frame. Defaults to 1.
+        void setDecodeThreads(const int numThreads);
+        
+        // True when frames are read straight from a memory mapping of the container
+        bool isMemoryMapped() const;
+        
+        // Get the compressed frame and its metadata JSON without copying. Only available when memory mapped,
+        // the views remain valid for the lifetime of the decoder.
+        void getFrameData(const Timestamp timestamp, BufferView& outData, BufferView& outMetadata) const;
         
         // Audio sample rate
         int audioSampleRateHz() const;
@@ -74,19 +156,58 @@ namespace motioncam {
     private:
         void init();
         void read(void* data, size_t size, size_t items=1) const;
+        void readAt(void* data, size_t size, int64_t offset) const;
         void readIndex();
         void reindexOffsets();
         void readExtra();
         void uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& dst);
+        void mapFile();
+        void fetchFrame(
+            const Timestamp timestamp,
+            PooledBuffer& scratch,
+            const uint8_t*& outData,
+            size_t& outSize,
+            nlohmann::json& outMetadata) const;
+        void fetchFrame(
+            const Timestamp timestamp,
+            const std::function<uint8_t*(size_t)>& allocate,
+            const uint8_t*& outData,
+            size_t& outSize,
+            nlohmann::json& outMetadata) const;
+        void fetchFrameData(
+            const Timestamp timestamp,
+            PooledBuffer& scratch,
+            const uint8_t*& outData,
+            size_t& outSize) const;
+        void decodeFrame(const uint8_t* data, const size_t size, const nlohmann::json& metadata, std::vector<uint16_t>& outData) const;
+        void decodeFrameRows(
+            const uint8_t* data,
+            const size_t size,
+            const FrameInfo& info,
+            const int rowStart,
+            const int rowCount,
+            uint16_t* dst,
+            const size_t dstStride) const;
+        void decodeFrame(
+            const uint8_t* data,
+            const size_t size,
+            const int width,
+            const int height,
+            const int compressionType,
+            uint16_t* dst,
+            const size_t dstStride) const;
         
     private:
         FILE* mFile;
+        const uint8_t* mMappedData;
+        size_t mMappedSize;
+        int mDecodeThreads;
         std::vector<BufferOffset> mOffsets;
         std::vector<BufferOffset> mAudioOffsets;
         std::map<Timestamp, BufferOffset> mFrameOffsetMap;
         std::vector<Timestamp> mFrameList;
         nlohmann::json mMetadata;
-        std::vector<uint8_t> mTmpBuffer;
+        mutable std::mutex mReadLock;
         std::unique_ptr<AudioChunkLoader> mAudioLoader;
     };
 } // namespace motioncam
@@ -32,6 +32,67 @@ namespace motioncam {
             const int height,
             const uint8_t* input,
             const size_t len);
+        
+        // Same as Decode but splits the frame into ranges of stripes that are decoded on
+        // up to threadCount threads of the shared thread pool.
+        size_t DecodeParallel(
+            uint16_t* output,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
+        
+        // Same as above but rows of output are stride pixels apart
+        size_t DecodeParallel(
+            uint16_t* output,
+            const size_t stride,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
+        
+        // Decodes a frame at half resolution into four (width/2) x (height/2) planes, one per position of the
+        // 2x2 colour filter pattern in row major order. Plane k starts at output + k * (width/2) * (height/2).
+        // Nothing is interpolated, each plane holds the values of its colour channel as they were encoded.
+        size_t DecodeHalfRes(
+            uint16_t* output,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
+        
+        // Decodes rows [rowStart, rowStart + rowCount) of a width x height frame into output, stride being the
+        // number of pixels between rows of output. Only the 4-row stripes covering the rows are unpacked,
+        // on up to threadCount threads of the shared thread pool.
+        size_t DecodeRowRange(
+            uint16_t* output,
+            const size_t stride,
+            const int rowStart,
+            const int rowCount,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
+        
+        // Decodes the regionWidth x regionHeight area at (x0, y0) of a width x height frame into output,
+        // stride being the number of pixels between rows of output. Stripes above and below the region
+        // are skipped and only the blocks covering its columns are unpacked. Returns 0 if the region does
+        // not fit within the frame.
+        size_t DecodeRegion(
+            uint16_t* output,
+            const size_t stride,
+            const int x0,
+            const int y0,
+            const int regionWidth,
+            const int regionHeight,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len);
             
         size_t DecodeLegacy(
             uint16_t* output,
@@ -39,6 +100,26 @@ namespace motioncam {
             const int height,
             const uint8_t* input,
             const size_t len);
+        
+        // Decodes the segments between the split offsets stored at the end of legacy frames on
+        // up to threadCount threads. Falls back to DecodeLegacy when the frame has no offsets.
+        size_t DecodeLegacyParallel(
+            uint16_t* output,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
+        
+        // Same as above but rows of output are stride pixels apart
+        size_t DecodeLegacyParallel(
+            uint16_t* output,
+            const size_t stride,
+            const int width,
+            const int height,
+            const uint8_t* input,
+            const size_t len,
+            const int threadCount);
     }
 }
 
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace motioncam {
+    class ThreadPool {
+    public:
+        ThreadPool(const unsigned int numThreads);
+        ~ThreadPool();
+        
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        
+        // Number of worker threads
+        unsigned int size() const;
+        
+        // Queue a task to run on one of the workers
+        void submit(std::function<void()> task);
+        
+        // Run fn(0) .. fn(count-1) on the workers and the calling thread, returns once all have completed.
+        // The first exception thrown by fn is rethrown on the calling thread.
+        void parallelFor(const int count, const std::function<void(int)>& fn);
+        
+        // Process wide pool with one worker per hardware thread
+        static ThreadPool& shared();
+        
+    private:
+        void run();
+        
+    private:
+        std::vector<std::thread> mThreads;
+        std::deque<std::function<void()>> mTasks;
+        std::mutex mLock;
+        std::condition_variable mCondition;
+        bool mStop;
+    };
+} // namespace motioncam
+
+#endif /* ThreadPool_hpp */
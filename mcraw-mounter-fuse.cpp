@@ -19,12 +19,18 @@
 #include <fuse.h>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
+#include <unordered_map>
 #include <deque>
+#include <memory>
+#include <mutex>
 #include <algorithm>
-#include <sstream>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <cmath>
+#include <thread>
 #include <unistd.h>
 #include <sys/statvfs.h>
 #include <cstring>    // for strdup, strerror
@@ -36,11 +42,16 @@
 #include <mach-o/dyld.h> // For _NSGetExecutablePath
 
 #include <motioncam/Decoder.hpp>
+#include <motioncam/BufferPool.hpp>
+#include <motioncam/Container.hpp>
+#include <motioncam/ThreadPool.hpp>
 #include <audiofile/AudioFile.h>
 
-#define TINY_DNG_WRITER_IMPLEMENTATION
-    #include <tinydng/tiny_dng_writer.h>
-#undef TINY_DNG_WRITER_IMPLEMENTATION
+#include "mounter/DngTemplate.hpp"
+#include "mounter/LosslessJpeg.hpp"
+#include "mounter/LruCache.hpp"
+#include "mounter/PackedPixels.hpp"
+#include "mounter/Preview.hpp"
 
 bool getAudio(
     std::vector<uint8_t>& fileData,
@@ -71,62 +82,205 @@ bool getAudio(
     return audio.getFileData(fileData);
 }
 
+// Rows of pixels decoded at a time when a read reaches them
+static constexpr int DECODE_BAND_ROWS = 64;
+
+// A frame DNG is its header followed by the pixels, which are decoded a band of rows at a time as reads reach them.
+// Tiled DNGs are served from the same rows, each row of a tile being a slice of a row of the frame. Compressed
+// DNGs are encoded in full when first opened and hold their tiles instead, each served from the buffer it was
+// encoded into. The preview, if any, follows the pixels and is cached separately.
+struct CachedFrame {
+    std::mutex lock; // held while the frame is loaded, decoded or read
+    bool loaded = false;
+    int index = 0;
+    motioncam::Timestamp timestamp = 0;
+    int width = 0;
+    int height = 0;
+    int compressionType = 0;
+    int bitsPerSample = 16;
+    size_t rowBytes = 0;
+    int tilesAcross = 0; // 0 when the pixels are a single strip
+    size_t tileRowBytes = 0;
+    size_t imageSize = 0;
+    size_t previewSize = 0;
+    std::vector<uint8_t> header;
+    motioncam::PooledBuffer pixels;
+    std::vector<bool> decodedBands;
+    std::vector<std::vector<uint8_t>> encodedTiles;
+    std::vector<size_t> encodedTileEnds; // end of each tile within the pixel data
+
+    // what the decoder needs to decode rows, without reading the metadata again
+    motioncam::FrameInfo info() const {
+        motioncam::FrameInfo info;
+        info.width = width;
+        info.height = height;
+        info.compressionType = compressionType;
+        return info;
+    }
+
+    size_t pixelsSize() const {
+        return encodedTiles.empty() ? imageSize : encodedTileEnds.back();
+    }
+
+    size_t size() const {
+        return header.size() + pixelsSize() + previewSize;
+    }
+
+    // bytes held in memory, what the frame is charged in the cache
+    size_t memorySize() const {
+        size_t bytes = header.capacity() + pixels.capacity();
+        for (auto &tile : encodedTiles)
+            bytes += tile.capacity();
+        return bytes;
+    }
+};
+
+// Where a clip is being read, to read ahead of frames read in order
+struct Readahead {
+    int lastIndex = -1;          // furthest frame read since the last seek
+    int run = 0;                 // times reading moved forward since the last seek
+    std::chrono::steady_clock::time_point lastTime;
+    double frameInterval = 0.0;  // smoothed seconds between frames read in order
+    double decodeTime = 0.0;     // smoothed seconds to read a frame ahead
+    size_t frameBytes = 0;       // memory of a frame read ahead
+    int queuedUpTo = -1;         // last frame queued to be read ahead
+    uint64_t generation = 0;     // bumped on a seek, frames queued before it are skipped
+};
+
+struct CachedPreview {
+    std::mutex lock; // held while the preview is rendered
+    bool loaded = false;
+    std::vector<uint8_t> pixels;
+};
+
+// A clip is only probed at mount, its decoder and everything read from it are set up by open_context the first time
+// anything in it is accessed and only read after that. The preview cache, sizes and templates are guarded by lock.
+// Frames are cached across all clips in frameCache. Cached entries are shared so eviction never frees one that is
+// being read.
 struct FSContext {
+    std::string path;
+    std::mutex openLock;
+    std::atomic<bool> ready{false};
+    bool failed = false;
+
+    std::mutex lock;
     motioncam::Decoder *decoder = nullptr;
     nlohmann::json containerMetadata;
     std::vector<std::string> filenames;
-    std::map<std::string, std::string> frameCache;
-    static constexpr size_t MAX_CACHE_FRAMES = 5;
-    std::deque<std::string> frameCacheOrder;
-    size_t frameSize = 0;
     std::vector<motioncam::Timestamp> frameList;
+    std::vector<size_t> frameSizes; // DNG size of each frame, 0 until its metadata has been read
+
+    // previews outlive the frames so browsing thumbnails never decodes at full resolution
+    std::map<motioncam::Timestamp, std::shared_ptr<CachedPreview>> previewCache;
+    static constexpr size_t MAX_CACHE_PREVIEWS = 64;
+    std::deque<motioncam::Timestamp> previewCacheOrder;
 
-    std::vector<uint16_t> blackLevels;
-    double whiteLevel = 0.0;
-    std::array<uint8_t, 4> cfa = {{0, 1, 1, 2}};
-    uint16_t orientation;
-    std::vector<float> colorMatrix1,
-        colorMatrix2,
-        forwardMatrix1,
-        forwardMatrix2;
+    motioncam::DngCameraInfo camera;
+    motioncam::DngFormat dngFormat;
+    std::map<std::pair<int, int>, std::unique_ptr<motioncam::DngTemplate>> dngTemplates;
     std::vector<uint8_t> audioWavData;
     size_t               audioSize = 0;
+    Readahead readahead;
 
     std::string baseName;
 };
 
 static std::map<std::string, FSContext> contexts;
 
+// contexts by base name, keyed by views of the names in contexts so paths are looked up without copying them
+static std::unordered_map<std::string_view, FSContext *> contextIndex;
+
+// a frame of a clip
+struct FrameKey {
+    const FSContext *ctx;
+    int index;
+
+    bool operator==(const FrameKey &other) const { return ctx == other.ctx && index == other.index; }
+};
+
+struct FrameKeyHash {
+    size_t operator()(const FrameKey &key) const {
+        return std::hash<const FSContext *>()(key.ctx) ^ (std::hash<int>()(key.index) * 0x9e3779b97f4a7c15ull);
+    }
+};
+
+// frames of every clip, evicted least recently used first once they hold more than the budget. the default budget
+// holds around 60 decoded 4K frames and can be changed with --cache-mb.
+static constexpr size_t DEFAULT_CACHE_MB = 1024;
+static motioncam::LruCache<FrameKey, CachedFrame, FrameKeyHash> frameCache(DEFAULT_CACHE_MB << 20);
+
+// how frame DNGs store their pixels, set from the command line
+static motioncam::DngCompression dngCompression = motioncam::DngCompression::NONE;
+static bool packPixels = false;
+static bool tiledLayout = false;
+static int previewWidth = 0;
+static int maxReadahead = 8;
+
 // call this once, right after containerMetadata is set:
 static void cache_container_metadata(FSContext *ctx)
 {
     // Black levels
+    motioncam::DngCameraInfo &camera = ctx->camera;
+
     std::vector<uint16_t> blackLevel = ctx->containerMetadata["blackLevel"];
-    ctx->blackLevels.clear();
-    ctx->blackLevels.reserve(blackLevel.size());
+    camera.blackLevels.clear();
+    camera.blackLevels.reserve(blackLevel.size());
     for (float v : blackLevel)
-        ctx->blackLevels.push_back(uint16_t(std::lround(v)));
+        camera.blackLevels.push_back(uint16_t(std::lround(v)));
 
     // White level
-    ctx->whiteLevel = ctx->containerMetadata["whiteLevel"];
+    camera.whiteLevel = ctx->containerMetadata["whiteLevel"];
 
     // CFA pattern
     std::string sensorArrangement = ctx->containerMetadata["sensorArrangment"];
-    ctx->colorMatrix1 = ctx->containerMetadata["colorMatrix1"].get<std::vector<float>>();
-    ctx->colorMatrix2 = ctx->containerMetadata["colorMatrix2"].get<std::vector<float>>();
-    ctx->forwardMatrix1 = ctx->containerMetadata["forwardMatrix1"].get<std::vector<float>>();
-    ctx->forwardMatrix2 = ctx->containerMetadata["forwardMatrix2"].get<std::vector<float>>();
+    camera.colorMatrix1 = ctx->containerMetadata["colorMatrix1"].get<std::vector<float>>();
+    camera.colorMatrix2 = ctx->containerMetadata["colorMatrix2"].get<std::vector<float>>();
+    camera.forwardMatrix1 = ctx->containerMetadata["forwardMatrix1"].get<std::vector<float>>();
+    camera.forwardMatrix2 = ctx->containerMetadata["forwardMatrix2"].get<std::vector<float>>();
 
     if (sensorArrangement == "rggb")
-        ctx->cfa = {{0, 1, 1, 2}};
+        camera.cfa = {{0, 1, 1, 2}};
     else if (sensorArrangement == "bggr")
-        ctx->cfa = {{2, 1, 1, 0}};
+        camera.cfa = {{2, 1, 1, 0}};
     else if (sensorArrangement == "grbg")
-        ctx->cfa = {{1, 0, 2, 1}};
+        camera.cfa = {{1, 0, 2, 1}};
     else if (sensorArrangement == "gbrg")
-        ctx->cfa = {{1, 2, 0, 1}};
+        camera.cfa = {{1, 2, 0, 1}};
     else
-        ctx->cfa = {{0, 1, 1, 2}};
+        camera.cfa = {{0, 1, 1, 2}};
+
+    // Lens shading, when the container has a map for the whole clip
+    motioncam::gainmap::Read(ctx->containerMetadata, camera.cfa, camera.lensShading);
+}
+
+// frames per second from the median spacing of the frame timestamps, so dropped frames don't skew it. 0 when
+// there are too few frames to tell.
+static double frame_rate(const std::vector<motioncam::Timestamp> &frames)
+{
+    std::vector<motioncam::Timestamp> deltas;
+    for (size_t i = 1; i < frames.size(); ++i)
+        if (frames[i] > frames[i - 1])
+            deltas.push_back(frames[i] - frames[i - 1]);
+    if (deltas.empty())
+        return 0.0;
+
+    std::nth_element(deltas.begin(), deltas.begin() + deltas.size() / 2, deltas.end());
+    return 1e9 / double(deltas[deltas.size() / 2]);
+}
+
+// the DNG header template for frames of the given size, built the first time a frame of that size is seen. clips
+// that only have lens shading maps per frame use the map of that first frame.
+static const motioncam::DngTemplate &dng_template(FSContext *ctx, const motioncam::FrameInfo &info)
+{
+    auto &dngTemplate = ctx->dngTemplates[std::make_pair(info.width, info.height)];
+    if (!dngTemplate) {
+        motioncam::DngCameraInfo camera = ctx->camera;
+        if (camera.lensShading.empty())
+            motioncam::gainmap::Read(info.metadata, camera.cfa, camera.lensShading);
+
+        dngTemplate.reset(new motioncam::DngTemplate(camera, info.width, info.height, ctx->dngFormat));
+    }
+    return *dngTemplate;
 }
 
 static std::string frameName(const std::string &base, int i)
@@ -136,32 +290,284 @@ static std::string frameName(const std::string &base, int i)
     return buf;
 }
 
-// decode one frame into frameCache[path]
-// after writing to cache, if this is the first frame, record its size
-static int load_frame(FSContext *ctx, const std::string &path)
+// whether the file starts with the header of a container the decoder reads. nothing past the header is read.
+static bool probe_clip(const std::string &path)
 {
-    // fast‐path if cached
-    if (ctx->frameCache.count(path))
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    motioncam::Header header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 header.version == motioncam::CONTAINER_VERSION &&
+                 memcmp(header.ident, motioncam::CONTAINER_ID, sizeof(motioncam::CONTAINER_ID)) == 0;
+    fclose(file);
+    return valid;
+}
+
+// open a clip the first time anything in it is accessed: the decoder reads its index, the frames are listed and
+// the audio is converted to a WAV. readers that arrive while it is opening wait for it. false if it can't be read.
+static bool open_context(FSContext *ctx)
+{
+    if (ctx->ready.load(std::memory_order_acquire))
+        return true;
+
+    std::lock_guard<std::mutex> lock(ctx->openLock);
+    if (ctx->ready.load(std::memory_order_relaxed))
+        return true;
+    if (ctx->failed)
+        return false;
+
+    // this runs inside a FUSE callback, so a clip with a missing or mistyped metadata key fails on its own instead of
+    // taking the mount down
+    const std::string &fullPath = ctx->path;
+    try {
+        // pass the absolute path into the decoder, frames are read from a memory mapping
+        ctx->decoder = new motioncam::Decoder(fullPath, true);
+
+        // decode each frame across all cores
+        ctx->decoder->setDecodeThreads(int(std::thread::hardware_concurrency()));
+
+        // preload frames + metadata
+        ctx->frameList         = ctx->decoder->getFrames();
+        ctx->containerMetadata = ctx->decoder->getContainerMetadata();
+        cache_container_metadata(ctx);
+        ctx->camera.frameRate = frame_rate(ctx->frameList);
+
+        ctx->dngFormat.compression = dngCompression;
+        ctx->dngFormat.tiled = tiledLayout;
+        ctx->dngFormat.previewWidth = previewWidth;
+        if (packPixels && dngCompression == motioncam::DngCompression::NONE)
+            ctx->dngFormat.bitsPerSample = motioncam::packed::BitsForWhiteLevel(ctx->camera.whiteLevel);
+
+        // prepare filename list, sizes are worked out when first asked for
+        for (size_t i = 0; i < ctx->frameList.size(); ++i) {
+            ctx->filenames.push_back(frameName(ctx->baseName, int(i)));
+        }
+        ctx->frameSizes.assign(ctx->frameList.size(), 0);
+    }
+    catch (std::exception &e) {
+        std::cerr << "Decoder error (" << fullPath << "): "
+             << e.what() << "\n";
+        delete ctx->decoder;
+        ctx->decoder = nullptr;
+        ctx->failed = true;
+        return false;
+    }
+
+    // ------------------------------------------------------------------
+    // extract & build WAV in memory from the decoder’s audio
+    // ------------------------------------------------------------------
+    try {
+        std::vector<motioncam::AudioChunk> audioChunks;
+        std::vector<uint8_t> fileData;
+        ctx->decoder->loadAudio(audioChunks);
+
+        int sampleRate  = ctx->decoder->audioSampleRateHz();
+        int numChannels = ctx->decoder->numAudioChannels();
+
+        getAudio(
+            fileData,
+            sampleRate,
+            numChannels,
+            audioChunks
+        );
+
+        ctx->audioWavData.assign(fileData.begin(), fileData.end());
+        ctx->audioSize = ctx->audioWavData.size();
+    }
+    catch (std::exception &e) {
+        std::cerr << "Audio processing error (" << fullPath << "): "
+             << e.what() << "\n";
+    }
+    // ------------------------------------------------------------------
+
+    ctx->ready.store(true, std::memory_order_release);
+    return true;
+}
+
+// index of the frame frameName gave fname, -1 if it isn't one of the clip's frames
+static int frame_index(const FSContext &ctx, std::string_view fname)
+{
+    const std::string_view base = ctx.baseName;
+    const std::string_view suffix = ".dng";
+    if (fname.size() < base.size() + 1 + 6 + suffix.size() || fname.substr(0, base.size()) != base ||
+        fname[base.size()] != '_' || fname.substr(fname.size() - suffix.size()) != suffix)
+        return -1;
+
+    // zero padded to six digits, longer numbers never start with a zero
+    std::string_view digits = fname.substr(base.size() + 1, fname.size() - base.size() - 1 - suffix.size());
+    if (digits.size() > 9 || (digits.size() > 6 && digits[0] == '0'))
+        return -1;
+
+    int idx = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9')
+            return -1;
+        idx = idx * 10 + (c - '0');
+    }
+    return idx < int(ctx.frameList.size()) ? idx : -1;
+}
+
+// what a path names:
+// "/"                  -> root
+// "/<base>"            -> directory for each mcraw
+// "/<base>/<frame>"    -> frame DNG
+// "/<base>/<base>.wav" -> audio
+struct ResolvedPath {
+    enum Kind { ROOT, CLIP, AUDIO, FRAME };
+
+    Kind kind = ROOT;
+    FSContext *ctx = nullptr;
+    int frameIndex = -1;
+};
+
+// resolve a path without copying any of it, -ENOENT if it names nothing
+static int resolve_path(const char *path, ResolvedPath &out)
+{
+    std::string_view p(path);
+    if (p.empty() || p[0] != '/')
+        return -ENOENT;
+
+    if (p.size() == 1) {
+        out.kind = ResolvedPath::ROOT;
         return 0;
+    }
+
+    std::string_view rest = p.substr(1);
+    size_t slash = rest.find('/');
+    auto it = contextIndex.find(rest.substr(0, slash));
+    if (it == contextIndex.end())
+        return -ENOENT;
+    out.ctx = it->second;
+
+    if (slash == std::string_view::npos) {
+        out.kind = ResolvedPath::CLIP;
+        return 0;
+    }
+
+    // anything inside a clip needs it open
+    if (!open_context(out.ctx))
+        return -EIO;
+
+    std::string_view fname = rest.substr(slash + 1);
+    const std::string_view base = out.ctx->baseName;
+    if (fname.size() == base.size() + 4 && fname.substr(0, base.size()) == base &&
+        fname.substr(base.size()) == ".wav") {
+        out.kind = ResolvedPath::AUDIO;
+        return 0;
+    }
+
+    out.frameIndex = frame_index(*out.ctx, fname);
+    if (out.frameIndex < 0)
+        return -ENOENT;
+    out.kind = ResolvedPath::FRAME;
+    return 0;
+}
 
-    // find the frame index
-    int idx = -1;
-    for (size_t i = 0; i < ctx->filenames.size(); ++i)
-        if (ctx->filenames[i] == path)
+// make sure rows [rowStart, rowEnd) of a cached frame are decoded, decoding the missing bands of rows
+static int decode_rows(FSContext *ctx, CachedFrame &frame, int rowStart, int rowEnd)
+{
+    if (frame.pixels.empty()) {
+        frame.pixels = motioncam::BufferPool::shared().acquire(frame.rowBytes * frame.height);
+        frameCache.resize(FrameKey{ctx, frame.index}, &frame, frame.memorySize());
+    }
+
+    int bandStart = rowStart / DECODE_BAND_ROWS;
+    int bandEnd = (rowEnd + DECODE_BAND_ROWS - 1) / DECODE_BAND_ROWS;
+
+    // legacy frames can only be decoded in full, do it all on the first read
+    if (frame.compressionType != motioncam::MOTIONCAM_COMPRESSION_TYPE) {
+        bandStart = 0;
+        bandEnd = int(frame.decodedBands.size());
+    }
+
+    // decode each run of missing bands with a single call
+    int band = bandStart;
+    while (band < bandEnd) {
+        if (frame.decodedBands[band]) {
+            ++band;
+            continue;
+        }
+
+        int runEnd = band;
+        while (runEnd < bandEnd && !frame.decodedBands[runEnd])
+            ++runEnd;
+
+        int y0 = band * DECODE_BAND_ROWS;
+        int y1 = std::min(runEnd * DECODE_BAND_ROWS, frame.height);
+        const motioncam::FrameInfo info = frame.info();
+        try
         {
-            idx = int(i);
-            break;
+            if (frame.bitsPerSample == 16) {
+                ctx->decoder->loadFrameRows(
+                    frame.timestamp, info, y0, y1 - y0, frame.pixels.as<uint16_t>() + size_t(y0) * frame.width, frame.width);
+            }
+            else {
+                // packed rows are smaller than decoded ones, decode elsewhere and pack into place
+                motioncam::PooledBuffer rows =
+                    motioncam::BufferPool::shared().acquire(sizeof(uint16_t) * size_t(frame.width) * (y1 - y0));
+                ctx->decoder->loadFrameRows(frame.timestamp, info, y0, y1 - y0, rows.as<uint16_t>(), frame.width);
+
+                for (int y = y0; y < y1; ++y)
+                    motioncam::packed::PackRow(rows.as<uint16_t>() + size_t(y - y0) * frame.width, frame.width,
+                                               frame.bitsPerSample, frame.pixels.data() + size_t(y) * frame.rowBytes);
+            }
         }
-    if (idx < 0)
-        return -ENOENT;
+        catch (std::exception &e)
+        {
+            std::cerr << "EIO error: " << e.what() << "\n";
+            return -EIO;
+        }
+
+        std::fill(frame.decodedBands.begin() + band, frame.decodedBands.begin() + runEnd, true);
+        band = runEnd;
+    }
+
+    return 0;
+}
+
+// decode a whole frame and compress its tiles on the shared thread pool, the tiles are stored back to back. each
+// row of tiles is decoded by its own task so the first tiles are compressed while later rows are still decoding.
+static int encode_frame(FSContext *ctx, CachedFrame &frame, const motioncam::DngTemplate &dngTemplate,
+                        const nlohmann::json &metadata)
+{
+    // legacy frames can only be decoded in full, do it up front
+    bool decodeTileRows = frame.compressionType == motioncam::MOTIONCAM_COMPRESSION_TYPE;
+    int err = decodeTileRows ? 0 : decode_rows(ctx, frame, 0, frame.height);
+    if (err < 0)
+        return err;
+    if (frame.pixels.empty())
+        frame.pixels = motioncam::BufferPool::shared().acquire(frame.rowBytes * frame.height);
+
+    const int tileSize = motioncam::DngTemplate::TILE_SIZE;
+    const int tilesAcross = dngTemplate.tilesAcross();
+    uint16_t *pixels = frame.pixels.as<uint16_t>();
+    std::vector<std::vector<uint8_t>> tiles(dngTemplate.numTiles());
+    const motioncam::FrameInfo info = frame.info();
 
-    // decode raw + per‐frame metadata
-    std::vector<uint16_t> raw;
-    nlohmann::json metadata;
     try
     {
-        auto ts = ctx->frameList[idx];
-        ctx->decoder->loadFrame(ts, raw, metadata);
+        motioncam::ThreadPool::shared().parallelFor(dngTemplate.tilesDown(), [&](int tileRow) {
+            int y0 = tileRow * tileSize;
+            int rows = std::min(tileSize, frame.height - y0);
+
+            if (decodeTileRows)
+                ctx->decoder->loadFrameRows(frame.timestamp, info, y0, rows, pixels + size_t(y0) * frame.width, frame.width);
+
+            motioncam::ThreadPool::shared().parallelFor(tilesAcross, [&](int tileColumn) {
+                int x0 = tileColumn * tileSize;
+
+                motioncam::ljpeg::EncodeTile(
+                    pixels + size_t(y0) * frame.width + x0,
+                    frame.width,
+                    std::min(tileSize, frame.width - x0),
+                    rows,
+                    tileSize,
+                    tileSize,
+                    tiles[tileRow * tilesAcross + tileColumn]);
+            });
+        });
     }
     catch (std::exception &e)
     {
@@ -169,127 +575,168 @@ static int load_frame(FSContext *ctx, const std::string &path)
         return -EIO;
     }
 
-    // pack into a DNGImage
-    tinydngwriter::DNGImage dng;
-    dng.SetCustomFieldLong(0x23, 23);
-    const unsigned int width = metadata["width"];
-    const unsigned int height = metadata["height"];
-    std::vector<float> asShotNeutral = metadata["asShotNeutral"];
-    dng.SetBigEndian(false);
-    dng.SetDNGVersion(1, 4, 0, 0);
-    dng.SetDNGBackwardVersion(1, 1, 0, 0);
-    dng.SetImageData(
-        (const unsigned char *)raw.data(),
-        raw.size());
-    dng.SetImageWidth(width);
-    dng.SetImageLength(height);
-    dng.SetPlanarConfig(tinydngwriter::PLANARCONFIG_CONTIG);
-    dng.SetPhotometric(tinydngwriter::PHOTOMETRIC_CFA);
-    dng.SetRowsPerStrip(height);
-    dng.SetSamplesPerPixel(1);
-    dng.SetCFARepeatPatternDim(2, 2);
-    
-    dng.SetBlackLevelRepeatDim(2, 2);
-    dng.SetBlackLevel(uint32_t(ctx->blackLevels.size()), ctx->blackLevels.data());
-    dng.SetWhiteLevel(ctx->whiteLevel);
-    dng.SetCompression(tinydngwriter::COMPRESSION_NONE);
+    std::vector<uint32_t> tileByteCounts;
+    size_t encodedSize = 0;
+    for (auto &tile : tiles) {
+        tileByteCounts.push_back(uint32_t(tile.size()));
+        encodedSize += tile.size();
+        frame.encodedTileEnds.push_back(encodedSize);
+    }
 
-    dng.SetCFAPattern(4, ctx->cfa.data());
-    
-    // Rectangular
-    dng.SetCFALayout(1);
+    dngTemplate.writeHeader(frame.timestamp - ctx->frameList.front(), metadata, tileByteCounts, frame.header);
 
-    const uint16_t bps[1] = { 16 };
-    dng.SetBitsPerSample(1, bps);
-    
-    dng.SetColorMatrix1(3, ctx->colorMatrix1.data());
-    dng.SetColorMatrix2(3, ctx->colorMatrix2.data());
+    // only the tiles are served from now on, straight from where they were encoded
+    frame.encodedTiles = std::move(tiles);
+    frame.pixels.reset();
 
-    dng.SetForwardMatrix1(3, ctx->forwardMatrix1.data());
-    dng.SetForwardMatrix2(3, ctx->forwardMatrix2.data());
-    
-    dng.SetAsShotNeutral(3, asShotNeutral.data());
-    
-    dng.SetCalibrationIlluminant1(21);
-    dng.SetCalibrationIlluminant2(17);
-    
-    dng.SetUniqueCameraModel("MotionCam");
-    dng.SetSubfileType();
-    
-    const uint32_t activeArea[4] = { 0, 0, height, width };
-    dng.SetActiveArea(&activeArea[0]);
-    if (ctx->orientation) {
-        dng.SetOrientation(ctx->orientation);
-    }
-
-    // Write DNG
-    std::string err;
-    tinydngwriter::DNGWriter writer(false);
-    writer.AddImage(&dng);
-    std::ostringstream oss;
-    if (!writer.WriteToFile(oss, &err))
+    return 0;
+}
+
+// fill in a frame's header from its metadata. no pixels are decoded here unless the DNG is compressed, which needs
+// every tile encoded before its header can be written.
+static int fill_frame(FSContext *ctx, CachedFrame &frame)
+{
+    // only the per‐frame metadata is needed for the header
+    motioncam::FrameInfo info;
+    try
     {
-        std::cerr << "DNG pack error: " << err << "\n";
+        ctx->decoder->getFrameInfo(frame.timestamp, info);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "EIO error: " << e.what() << "\n";
         return -EIO;
     }
 
-    // insert into rolling‐buffer cache
-    if (ctx->frameCache.size() >= FSContext::MAX_CACHE_FRAMES)
+    frame.width = info.width;
+    frame.height = info.height;
+    frame.compressionType = info.compressionType;
+    frame.decodedBands.assign((info.height + DECODE_BAND_ROWS - 1) / DECODE_BAND_ROWS, false);
+
+    // templates are never removed, so they can be used once the context is unlocked
+    const motioncam::DngTemplate *dngTemplate;
     {
-        ctx->frameCache.erase(ctx->frameCacheOrder.front());
-        ctx->frameCacheOrder.pop_front();
+        std::lock_guard<std::mutex> lock(ctx->lock);
+        dngTemplate = &dng_template(ctx, info);
+    }
+
+    // fill in the per-frame values of the header
+    frame.bitsPerSample = dngTemplate->bitsPerSample();
+    frame.rowBytes = dngTemplate->rowBytes();
+    frame.imageSize = dngTemplate->imageSize();
+    frame.previewSize = dngTemplate->previewSize();
+    if (dngTemplate->tiled()) {
+        frame.tilesAcross = dngTemplate->tilesAcross();
+        frame.tileRowBytes = dngTemplate->tileRowBytes();
+    }
+    if (dngTemplate->compression() == motioncam::DngCompression::NONE) {
+        dngTemplate->writeHeader(frame.timestamp - ctx->frameList.front(), info.metadata, frame.header);
+    }
+    else {
+        int err = encode_frame(ctx, frame, *dngTemplate, info.metadata);
+        if (err < 0)
+            return err;
+    }
+
+    std::lock_guard<std::mutex> lock(ctx->lock);
+    ctx->frameSizes[frame.index] = frame.size();
+    return 0;
+}
+
+// look up frameCache for frame idx, loading it the first time. the frame is returned locked, and a reader that finds
+// a frame still being loaded waits for that load instead of starting another. outLoaded is set when this call
+// loaded it.
+static int load_frame(FSContext *ctx, int idx, std::shared_ptr<CachedFrame> &outFrame,
+                      std::unique_lock<std::mutex> &outLock, bool *outLoaded = nullptr)
+{
+    // inserted before loading, so other readers find it
+    FrameKey key{ctx, idx};
+    bool inserted = false;
+    std::shared_ptr<CachedFrame> frame = frameCache.findOrInsert(key, inserted);
+
+    std::unique_lock<std::mutex> frameLock(frame->lock);
+    if (!frame->loaded) {
+        frame->index = idx;
+        frame->timestamp = ctx->frameList[idx];
+
+        int err = fill_frame(ctx, *frame);
+        if (err < 0) {
+            // drop it so the next reader tries again
+            frameCache.erase(key, frame.get());
+            return err;
+        }
+        frame->loaded = true;
+        frameCache.resize(key, frame.get(), frame->memorySize());
+
+        if (outLoaded)
+            *outLoaded = true;
     }
-    ctx->frameCache[path] = oss.str();
-    ctx->frameCacheOrder.push_back(path);
 
-    // record frame‐size once
-    if (ctx->frameSize == 0)
+    outFrame = std::move(frame);
+    outLock = std::move(frameLock);
+    return 0;
+}
+
+// size of a frame's DNG, worked out from the template for its dimensions. only the frame metadata is read. the size
+// of a compressed DNG is only known once it is encoded, so the frame is loaded here and stays cached for the reads
+// that usually follow. encoding always gives the same bytes, so the size kept for the frame holds after it is
+// evicted and encoded again.
+static int frame_size(FSContext *ctx, size_t idx, size_t &outSize)
+{
+    {
+        std::lock_guard<std::mutex> lock(ctx->lock);
+        if (ctx->frameSizes[idx] != 0) {
+            outSize = ctx->frameSizes[idx];
+            return 0;
+        }
+    }
+
+    if (dngCompression != motioncam::DngCompression::NONE) {
+        std::shared_ptr<CachedFrame> frame;
+        std::unique_lock<std::mutex> frameLock;
+        int err = load_frame(ctx, int(idx), frame, frameLock);
+        if (err < 0)
+            return err;
+
+        outSize = frame->size();
+        return 0;
+    }
+
+    motioncam::FrameInfo info;
+    try
+    {
+        ctx->decoder->getFrameInfo(ctx->frameList[idx], info);
+    }
+    catch (std::exception &e)
     {
-        ctx->frameSize = ctx->frameCache[path].size();
+        std::cerr << "EIO error: " << e.what() << "\n";
+        return -EIO;
     }
 
+    std::lock_guard<std::mutex> lock(ctx->lock);
+    ctx->frameSizes[idx] = dng_template(ctx, info).fileSize();
+    outSize = ctx->frameSizes[idx];
     return 0;
 }
 
-// report uniform size (0 until we have it)
+// report the size of each frame's DNG
 static int fs_getattr(const char *path, struct stat *st)
 {
-    // path == "/"                -> root
-    // path == "/<base>"          -> directory for each mcraw
-    // path == "/<base>/<frame>"  -> file
-    std::string p(path);
     memset(st, 0, sizeof(*st));
 
-    if (p == "/") {
+    ResolvedPath resolved;
+    int err = resolve_path(path, resolved);
+    if (err < 0)
+        return err;
+
+    if (resolved.kind == ResolvedPath::ROOT || resolved.kind == ResolvedPath::CLIP) {
         st->st_mode = S_IFDIR | 0555;
         st->st_nlink = 2;
         return 0;
     }
 
-    // strip leading "/"
-    std::string rest = p.substr(1);
-    auto slash = rest.find('/');
-    if (slash == std::string::npos) {
-        // first‐level entry must be one of the mcraw basenames
-        if (contexts.count(rest)) {
-            st->st_mode = S_IFDIR | 0555;
-            st->st_nlink = 2;
-            return 0;
-        }
-        return -ENOENT;
-    }
-
-    // deeper: must be a frame file in that context
-    std::string base = rest.substr(0, slash);
-    std::string fname = rest.substr(slash + 1);
-    auto it = contexts.find(base);
-    if (it == contexts.end())
-        return -ENOENT;
-    FSContext &ctx = it->second;
-
-    // if they asked for "<base>.wav"
-    std::string audioName = ctx.baseName + ".wav";
-    if (fname == audioName) {
+    FSContext &ctx = *resolved.ctx;
+    if (resolved.kind == ResolvedPath::AUDIO) {
         if (ctx.audioSize == 0)
             return -ENOENT;
         st->st_mode = S_IFREG | 0444;
@@ -298,13 +745,14 @@ static int fs_getattr(const char *path, struct stat *st)
         return 0;
     }
 
-    // else must be one of the frame DNGs
-    if (std::find(ctx.filenames.begin(), ctx.filenames.end(), fname) == ctx.filenames.end())
-        return -ENOENT;
+    size_t frameSize = 0;
+    err = frame_size(&ctx, size_t(resolved.frameIndex), frameSize);
+    if (err < 0)
+        return err;
 
     st->st_mode = S_IFREG | 0444;
     st->st_nlink = 1;
-    st->st_size = (off_t)ctx.frameSize;
+    st->st_size = (off_t)frameSize;
     return 0;
 }
 
@@ -312,10 +760,14 @@ static int fs_readdir(const char *path, void *buf,
                       fuse_fill_dir_t filler,
                       off_t offset, struct fuse_file_info *fi)
 {
-    std::string p(path);
     (void)offset; (void)fi;
 
-    if (p == "/") {
+    ResolvedPath resolved;
+    int err = resolve_path(path, resolved);
+    if (err < 0)
+        return err;
+
+    if (resolved.kind == ResolvedPath::ROOT) {
         filler(buf, ".", nullptr, 0);
         filler(buf, "..", nullptr, 0);
         for (auto &kv : contexts) {
@@ -324,13 +776,12 @@ static int fs_readdir(const char *path, void *buf,
         return 0;
     }
 
-    // strip leading "/"
-    std::string rest = p.substr(1);
     // must be a context directory
-    auto it = contexts.find(rest);
-    if (it == contexts.end())
-        return -ENOENT;
-    FSContext &ctx = it->second;
+    if (resolved.kind != ResolvedPath::CLIP)
+        return -ENOTDIR;
+    FSContext &ctx = *resolved.ctx;
+    if (!open_context(&ctx))
+        return -EIO;
 
     filler(buf, ".", nullptr, 0);
     filler(buf, "..", nullptr, 0);
@@ -348,62 +799,297 @@ static int fs_readdir(const char *path, void *buf,
     return 0;
 }
 
+// the resolved path is kept in fh until the file is released, so reads don't resolve it again
 static int fs_open(const char *path, struct fuse_file_info *fi)
 {
-    std::string p(path);
-    // must be /<base>/<frame>
-    if (p.size() < 2 || p[0] != '/')
-        return -ENOENT;
-    std::string rest = p.substr(1);
-    auto slash = rest.find('/');
-    if (slash == std::string::npos)
-        return -EISDIR; // it's a directory, not a file
+    ResolvedPath resolved;
+    int err = resolve_path(path, resolved);
+    if (err < 0)
+        return err;
 
-    std::string base = rest.substr(0, slash);
-    std::string fname = rest.substr(slash + 1);
-    auto it = contexts.find(base);
-    if (it == contexts.end())
+    if (resolved.kind == ResolvedPath::ROOT || resolved.kind == ResolvedPath::CLIP)
+        return -EISDIR; // it's a directory, not a file
+    if (resolved.kind == ResolvedPath::AUDIO && resolved.ctx->audioSize == 0)
         return -ENOENT;
-    FSContext &ctx = it->second;
+    if ((fi->flags & 3) != O_RDONLY)
+        return -EACCES;
 
-    // allow read‐only audio.wav
-    std::string audioName = ctx.baseName + ".wav";
-    if (fname == audioName) {
-        return (fi->flags & 3) == O_RDONLY ? 0 : -EACCES;
+    fi->fh = uint64_t(reinterpret_cast<uintptr_t>(new ResolvedPath(resolved)));
+    return 0;
+}
+
+static int fs_release(const char *path, struct fuse_file_info *fi)
+{
+    (void)path;
+    delete reinterpret_cast<ResolvedPath *>(uintptr_t(fi->fh));
+    fi->fh = 0;
+    return 0;
+}
+
+// copy n bytes of an uncompressed tiled DNG's pixels, decoding the rows of the tiles they come from. tiles past
+// the edges of the frame are padded with zeros.
+static int read_tiles(FSContext *ctx, CachedFrame &frame, size_t pixelStart, size_t n, char *dst)
+{
+    const int tileSize = motioncam::DngTemplate::TILE_SIZE;
+    const size_t tileBytes = frame.tileRowBytes * tileSize;
+    size_t firstTile = pixelStart / tileBytes;
+    size_t lastTile = (pixelStart + n - 1) / tileBytes;
+
+    // rows within the tile when the read stays in one, otherwise every row of the rows of tiles it covers
+    int rowStart = int(firstTile / frame.tilesAcross) * tileSize;
+    int rowEnd = int(lastTile / frame.tilesAcross + 1) * tileSize;
+    if (firstTile == lastTile) {
+        rowEnd = rowStart + int((pixelStart + n - 1) % tileBytes / frame.tileRowBytes) + 1;
+        rowStart += int(pixelStart % tileBytes / frame.tileRowBytes);
+    }
+    rowEnd = std::min(rowEnd, frame.height);
+
+    if (rowStart < rowEnd) {
+        int err = decode_rows(ctx, frame, rowStart, rowEnd);
+        if (err < 0)
+            return err;
+    }
+
+    // a row of a tile at a time
+    size_t pos = pixelStart;
+    size_t end = pixelStart + n;
+    while (pos < end) {
+        size_t tile = pos / tileBytes;
+        size_t column = pos % tileBytes % frame.tileRowBytes;
+        int y = int(tile / frame.tilesAcross) * tileSize + int(pos % tileBytes / frame.tileRowBytes);
+        size_t x = (tile % frame.tilesAcross) * frame.tileRowBytes + column;
+
+        size_t len = std::min(frame.tileRowBytes - column, end - pos);
+        size_t valid = (y < frame.height && x < frame.rowBytes) ? std::min(len, frame.rowBytes - x) : 0;
+
+        memcpy(dst, frame.pixels.data() + size_t(y) * frame.rowBytes + x, valid);
+        memset(dst + valid, 0, len - valid);
+
+        dst += len;
+        pos += len;
     }
 
-    // otherwise fall through to DNG frames
-    if (std::find(ctx.filenames.begin(), ctx.filenames.end(), fname) == ctx.filenames.end())
-        return -ENOENT;
-    if ((fi->flags & 3) != O_RDONLY)
-        return -EACCES;
     return 0;
 }
 
+// look up previewCache[frame.timestamp], rendering the preview from a half resolution decode of the frame. readers
+// of a preview that is being rendered wait for it.
+static int load_preview(FSContext *ctx, const CachedFrame &frame, std::shared_ptr<CachedPreview> &outPreview)
+{
+    std::shared_ptr<CachedPreview> preview;
+    {
+        std::lock_guard<std::mutex> lock(ctx->lock);
+
+        auto &cached = ctx->previewCache[frame.timestamp];
+        if (!cached) {
+            cached = std::make_shared<CachedPreview>();
+            ctx->previewCacheOrder.push_back(frame.timestamp);
+        }
+        preview = cached;
+
+        if (ctx->previewCache.size() > FSContext::MAX_CACHE_PREVIEWS)
+        {
+            ctx->previewCache.erase(ctx->previewCacheOrder.front());
+            ctx->previewCacheOrder.pop_front();
+        }
+    }
+
+    std::lock_guard<std::mutex> previewLock(preview->lock);
+    if (!preview->loaded) {
+        try
+        {
+            std::vector<uint16_t> planes;
+            nlohmann::json metadata;
+            ctx->decoder->loadFrameProxy(frame.timestamp, planes, metadata);
+
+            std::vector<float> asShotNeutral = metadata["asShotNeutral"];
+            preview->pixels.resize(frame.previewSize);
+            motioncam::preview::Render(planes.data(), frame.width, frame.height, ctx->dngFormat.previewWidth,
+                                       ctx->camera, asShotNeutral, preview->pixels.data());
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "EIO error: " << e.what() << "\n";
+            return -EIO;
+        }
+        preview->loaded = true;
+    }
+
+    outPreview = std::move(preview);
+    return 0;
+}
+
+// copy n bytes of a compressed DNG's tiles, gathered from the tile buffers they span
+static void read_encoded(const CachedFrame &frame, size_t pixelStart, size_t n, char *dst)
+{
+    size_t tile = std::upper_bound(frame.encodedTileEnds.begin(), frame.encodedTileEnds.end(), pixelStart) -
+                  frame.encodedTileEnds.begin();
+
+    while (n > 0) {
+        size_t tileStart = frame.encodedTileEnds[tile] - frame.encodedTiles[tile].size();
+        size_t len = std::min(n, frame.encodedTileEnds[tile] - pixelStart);
+
+        memcpy(dst, frame.encodedTiles[tile].data() + (pixelStart - tileStart), len);
+
+        dst += len;
+        pixelStart += len;
+        n -= len;
+        ++tile;
+    }
+}
+
+// frames are read ahead by their own workers, each decode still spreading across the shared pool
+static constexpr int READAHEAD_THREADS = 2;
+
+// frames read in order after a seek before reading ahead
+static constexpr int READAHEAD_RUN = 2;
+
+// reads this many frames either side of where a clip is being read, or of what is queued, are still in order. FUSE
+// serves reads on several threads and players read a few frames at once, so frames arrive slightly out of order.
+static constexpr int READAHEAD_WINDOW = 8;
+
+// rows decoded between checks for a seek
+static constexpr int READAHEAD_ROWS = 4 * DECODE_BAND_ROWS;
+
+static std::atomic<uint64_t> readaheadFrames{0};
+static std::atomic<uint64_t> readaheadCancelled{0};
+
+// created by main before FUSE starts and joined once it stops, so no read-ahead outlives the statics it uses
+static std::unique_ptr<motioncam::ThreadPool> readaheadPool;
+
+// decode frame idx into the frame cache ahead of its reads, giving up if there has been a seek since it was queued
+static void read_ahead_frame(FSContext *ctx, int idx, uint64_t generation)
+{
+    auto stale = [&]() {
+        std::lock_guard<std::mutex> lock(ctx->lock);
+        if (ctx->readahead.generation == generation)
+            return false;
+        ++readaheadCancelled;
+        return true;
+    };
+
+    if (stale())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<CachedFrame> frame;
+    std::unique_lock<std::mutex> frameLock;
+    bool decoded = false;
+    if (load_frame(ctx, idx, frame, frameLock, &decoded) < 0)
+        return;
+
+    // compressed frames are encoded in full by the load
+    if (frame->encodedTiles.empty()) {
+        for (int y = 0; y < frame->height; y += READAHEAD_ROWS) {
+            int rowEnd = std::min(y + READAHEAD_ROWS, frame->height);
+            auto bandsEnd = frame->decodedBands.begin() + (rowEnd + DECODE_BAND_ROWS - 1) / DECODE_BAND_ROWS;
+            if (std::find(frame->decodedBands.begin() + y / DECODE_BAND_ROWS, bandsEnd, false) == bandsEnd)
+                continue;
+
+            if (stale() || decode_rows(ctx, *frame, y, rowEnd) < 0)
+                return;
+            decoded = true;
+        }
+    }
+
+    if (frame->previewSize > 0) {
+        std::shared_ptr<CachedPreview> preview;
+        load_preview(ctx, *frame, preview);
+    }
+
+    ++readaheadFrames;
+
+    // frames that were already in the cache say nothing about how long a decode takes
+    if (!decoded)
+        return;
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(ctx->lock);
+    Readahead &readahead = ctx->readahead;
+    readahead.decodeTime = readahead.decodeTime > 0 ? 0.75 * readahead.decodeTime + 0.25 * elapsed : elapsed;
+    readahead.frameBytes = frame->memorySize();
+}
+
+// called for every read of a frame. once frames are being read in order, the frames after it are queued to be
+// decoded ahead, as many as are read in the time one takes to decode so playback keeps up, within maxReadahead and
+// half the frame cache. reading a frame outside READAHEAD_WINDOW is a seek, which cancels what was queued.
+static void read_ahead(FSContext *ctx, int idx)
+{
+    if (maxReadahead == 0 || !readaheadPool)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    int first, last;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(ctx->lock);
+        Readahead &readahead = ctx->readahead;
+
+        bool nearby = readahead.lastIndex >= 0 && idx >= readahead.lastIndex - READAHEAD_WINDOW &&
+                      idx <= std::max(readahead.lastIndex, readahead.queuedUpTo) + READAHEAD_WINDOW;
+
+        // frames at or behind the furthest one read are still being read, nothing more to queue
+        if (nearby && idx <= readahead.lastIndex)
+            return;
+
+        if (nearby) {
+            double interval = std::chrono::duration<double>(now - readahead.lastTime).count() /
+                              (idx - readahead.lastIndex);
+            readahead.frameInterval =
+                readahead.frameInterval > 0 ? 0.75 * readahead.frameInterval + 0.25 * interval : interval;
+            ++readahead.run;
+        }
+        else {
+            readahead.run = 0;
+            readahead.frameInterval = 0.0;
+            readahead.queuedUpTo = idx;
+            ++readahead.generation;
+        }
+        readahead.lastIndex = idx;
+        readahead.lastTime = now;
+
+        if (readahead.run < READAHEAD_RUN)
+            return;
+
+        size_t depth = 2;
+        if (readahead.decodeTime > 0 && readahead.frameInterval > 0)
+            depth = size_t(std::ceil(readahead.decodeTime / readahead.frameInterval)) + 1;
+        if (readahead.frameBytes > 0)
+            depth = std::min(depth, frameCache.maxBytes() / (2 * readahead.frameBytes));
+        depth = std::max<size_t>(1, std::min<size_t>(depth, maxReadahead));
+
+        first = std::max(readahead.queuedUpTo + 1, idx + 1);
+        last = std::min(idx + int(depth), int(ctx->frameList.size()) - 1);
+        readahead.queuedUpTo = std::max(readahead.queuedUpTo, last);
+        generation = readahead.generation;
+    }
+
+    for (int i = first; i <= last; ++i)
+        readaheadPool->submit([ctx, i, generation]() { read_ahead_frame(ctx, i, generation); });
+}
+
 static int fs_read(const char *path,
                    char *buf,
                    size_t size,
                    off_t offset,
                    struct fuse_file_info *fi)
 {
-    (void)fi;
-    std::string p(path);
-    // parse "/<base>/<frame>"
-    std::string rest = p.substr(1);
-    auto slash = rest.find('/');
-    if (slash == std::string::npos)
+    // the path resolved at open, or resolved now if there was no open
+    ResolvedPath resolved;
+    if (fi && fi->fh) {
+        resolved = *reinterpret_cast<const ResolvedPath *>(uintptr_t(fi->fh));
+    }
+    else {
+        int err = resolve_path(path, resolved);
+        if (err < 0)
+            return err;
+    }
+    if (resolved.kind == ResolvedPath::ROOT || resolved.kind == ResolvedPath::CLIP)
         return -EISDIR;
-
-    std::string base = rest.substr(0, slash);
-    std::string fname = rest.substr(slash + 1);
-    auto it = contexts.find(base);
-    if (it == contexts.end())
-        return -ENOENT;
-    FSContext &ctx = it->second;
+    FSContext &ctx = *resolved.ctx;
 
     // if it's the wav file, serve the buffer
-    std::string audioName = ctx.baseName + ".wav";
-    if (fname == audioName) {
+    if (resolved.kind == ResolvedPath::AUDIO) {
         if ((size_t)offset >= ctx.audioSize)
             return 0;
         size_t tocopy = std::min<size_t>(size, ctx.audioSize - (size_t)offset);
@@ -411,18 +1097,65 @@ static int fs_read(const char *path,
         return (ssize_t)tocopy;
     }
 
-    // otherwise decode & serve a frame
-    int err = load_frame(&ctx, fname);
+    // otherwise serve a frame, decoding only the rows this read covers
+    int idx = resolved.frameIndex;
+    read_ahead(&ctx, idx);
+
+    std::shared_ptr<CachedFrame> frame;
+    std::unique_lock<std::mutex> frameLock;
+    int err = load_frame(&ctx, idx, frame, frameLock);
     if (err < 0)
         return err;
-    auto it2 = ctx.frameCache.find(fname);
-    if (it2 == ctx.frameCache.end())
-        return -ENOENT;
-    const std::string &data = it2->second;
-    if ((size_t)offset >= data.size())
+    if ((size_t)offset >= frame->size())
         return 0;
-    size_t tocopy = std::min<size_t>(size, data.size() - (size_t)offset);
-    memcpy(buf, data.data() + offset, tocopy);
+    size_t tocopy = std::min<size_t>(size, frame->size() - (size_t)offset);
+
+    // the header, then the pixels straight from the decoded buffer or the encoded tiles, then the preview
+    size_t pos = (size_t)offset;
+    size_t copied = 0;
+    if (pos < frame->header.size()) {
+        size_t n = std::min(tocopy, frame->header.size() - pos);
+        memcpy(buf, frame->header.data() + pos, n);
+        copied += n;
+        pos += n;
+    }
+
+    size_t pixelsEnd = frame->header.size() + frame->pixelsSize();
+    if (copied < tocopy && pos < pixelsEnd) {
+        size_t pixelStart = pos - frame->header.size();
+        size_t n = std::min(tocopy - copied, pixelsEnd - pos);
+
+        if (!frame->encodedTiles.empty()) {
+            read_encoded(*frame, pixelStart, n, buf + copied);
+        }
+        else if (frame->tilesAcross > 0) {
+            err = read_tiles(&ctx, *frame, pixelStart, n, buf + copied);
+            if (err < 0)
+                return err;
+        }
+        else {
+            size_t pixelEnd = pixelStart + n;
+            size_t rowBytes = frame->rowBytes;
+
+            err = decode_rows(&ctx, *frame, int(pixelStart / rowBytes), int((pixelEnd + rowBytes - 1) / rowBytes));
+            if (err < 0)
+                return err;
+
+            memcpy(buf + copied, frame->pixels.data() + pixelStart, n);
+        }
+        copied += n;
+        pos += n;
+    }
+
+    if (copied < tocopy) {
+        std::shared_ptr<CachedPreview> preview;
+        err = load_preview(&ctx, *frame, preview);
+        if (err < 0)
+            return err;
+
+        memcpy(buf + copied, preview->pixels.data() + (pos - pixelsEnd), tocopy - copied);
+    }
+
     return (ssize_t)tocopy;
 }
 
@@ -431,14 +1164,51 @@ static struct fuse_operations fs_ops = {
     .readdir = fs_readdir,
     .open    = fs_open,
     .read    = fs_read,
+    .release = fs_release,
 };
 
 int main(int argc, char *argv[])
 {
-    // This program takes no arguments (we manage FUSE args ourselves).
-    if (argc != 1) {
-        std::cerr << "Usage: " << argv[0] << "\n";
-        return 1;
+    // Only our own options, FUSE args are managed by us.
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--lj92") {
+            dngCompression = motioncam::DngCompression::LOSSLESS_JPEG;
+        }
+        else if (arg == "--packed") {
+            packPixels = true;
+        }
+        else if (arg == "--tiled") {
+            tiledLayout = true;
+        }
+        else if (arg == "--preview" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            previewWidth = std::atoi(argv[++i]);
+        }
+        else if (arg == "--readahead" && i + 1 < argc && std::atoi(argv[i + 1]) >= 0) {
+            maxReadahead = std::atoi(argv[++i]);
+        }
+        else if (arg == "--cache-mb" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            frameCache.setMaxBytes(size_t(std::atoi(argv[++i])) << 20);
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--lj92] [--packed] [--tiled] [--preview <width>] [--cache-mb <n>] [--readahead <frames>]\n"
+                      << "  --lj92    write lossless JPEG compressed DNGs. smaller files, but each frame is\n"
+                      << "            decoded and compressed in full the first time it is read or its size is\n"
+                      << "            listed\n"
+                      << "  --packed  bit-pack uncompressed DNGs to the fewest of 10, 12 or 14 bits that\n"
+                      << "            hold the white level of the clip\n"
+                      << "  --tiled   store uncompressed DNGs in 256x256 tiles, so reading part of the image\n"
+                      << "            only decodes the rows of the tiles it covers. lj92 DNGs are always tiled\n"
+                      << "  --preview <width>\n"
+                      << "            embed an 8-bit RGB preview at most width pixels wide, e.g. 256 or 1024.\n"
+                      << "            it is rendered from a half resolution decode when first read\n"
+                      << "  --cache-mb <n>\n"
+                      << "            keep at most n MB of frames in memory across all clips, 1024 by default\n"
+                      << "  --readahead <frames>\n"
+                      << "            decode up to this many frames ahead when frames are read in order, 8 by\n"
+                      << "            default. 0 turns reading ahead off\n";
+            return 1;
+        }
     }
 
     // 1) figure out our own executable's directory
@@ -469,65 +1239,17 @@ int main(int argc, char *argv[])
 
             std::cout << "Found file: " << fullPath << "\n";
 
-            FSContext ctx;
-            ctx.baseName = baseName;
-            try {
-                // pass the absolute path into the decoder
-                ctx.decoder = new motioncam::Decoder(fullPath);
-            }
-            catch (std::exception &e) {
-                std::cerr << "Decoder error (" << fullPath << "): "
-                     << e.what() << "\n";
+            // only the header is read now, the clip is opened when it is first accessed
+            if (!probe_clip(fullPath)) {
+                std::cerr << "Decoder error (" << fullPath << "): not a MotionCam container\n";
                 continue;
             }
 
-            // preload frames + metadata
-            ctx.frameList         = ctx.decoder->getFrames();
-            ctx.containerMetadata = ctx.decoder->getContainerMetadata();
-            cache_container_metadata(&ctx);
-
-            std::cerr << "DEBUG: [" << fullPath << "] found "
-                 << ctx.frameList.size() << " frames\n";
-
-            // prepare filename list
-            for (size_t i = 0; i < ctx.frameList.size(); ++i) {
-                ctx.filenames.push_back(frameName(baseName, int(i)));
-            }
-
-            // warm up first frame
-            if (!ctx.filenames.empty()) {
-                load_frame(&ctx, ctx.filenames[0]);
-            }
-
-            // ------------------------------------------------------------------
-            // extract & build WAV in memory from the decoder’s audio
-            // ------------------------------------------------------------------
-            try {
-                std::vector<motioncam::AudioChunk> audioChunks;
-                std::vector<uint8_t> fileData;
-                ctx.decoder->loadAudio(audioChunks);
-
-                int sampleRate  = ctx.decoder->audioSampleRateHz();
-                int numChannels = ctx.decoder->numAudioChannels();
-
-                auto wavBytes = getAudio(
-                    fileData,
-                    sampleRate,
-                    numChannels,
-                    audioChunks
-                );
-
-                ctx.audioWavData.assign(fileData.begin(), fileData.end());
-                ctx.audioSize = ctx.audioWavData.size();
-            }
-            catch (std::exception &e) {
-                std::cerr << "Audio processing error (" << fullPath << "): "
-                     << e.what() << "\n";
-            }
-            // ------------------------------------------------------------------
-
-            // stash context under the base name
-            contexts.emplace(baseName, std::move(ctx));
+            // contexts hold locks, so they are built in place under the base name
+            FSContext &ctx = contexts[baseName];
+            contextIndex[contexts.find(baseName)->first] = &ctx;
+            ctx.baseName = baseName;
+            ctx.path = fullPath;
         }
     }
     closedir(d);
@@ -555,19 +1277,40 @@ int main(int argc, char *argv[])
         "noapplexattr,"
         "volname=" + volname;
 
-    int fuse_argc = 6;
-    char *fuse_argv[7];
+    // multithreaded, each context and cached frame has its own lock
+    int fuse_argc = 5;
+    char *fuse_argv[6];
     fuse_argv[0] = argv[0];
     fuse_argv[1] = (char*)"-f";  // foreground
-    fuse_argv[2] = (char*)"-s";  // single-threaded
-    fuse_argv[3] = (char*)"-o";  // mount options
-    fuse_argv[4] = (char*)mountOptions.c_str();
-    fuse_argv[5] = (char*)mountPoint.c_str();
-    fuse_argv[6] = nullptr;
+    fuse_argv[2] = (char*)"-o";  // mount options
+    fuse_argv[3] = (char*)mountOptions.c_str();
+    fuse_argv[4] = (char*)mountPoint.c_str();
+    fuse_argv[5] = nullptr;
+
+    // the shared pool read-ahead decodes on is built first, so it is destroyed after anything still using it
+    motioncam::ThreadPool::shared();
+    if (maxReadahead > 0)
+        readaheadPool.reset(new motioncam::ThreadPool(READAHEAD_THREADS));
 
     // 4) run FUSE
     int ret = fuse_main(fuse_argc, fuse_argv, &fs_ops, nullptr);
 
+    // skip whatever is still queued to be read ahead, then wait for the frames being decoded
+    for (auto &kv : contexts) {
+        std::lock_guard<std::mutex> lock(kv.second.lock);
+        ++kv.second.readahead.generation;
+    }
+    readaheadPool.reset();
+
+    auto poolStats = motioncam::BufferPool::shared().stats();
+    std::cerr << "Buffer pool: " << poolStats.allocations << " allocations, "
+              << poolStats.hits << " reused\n";
+
+    auto cacheStats = frameCache.stats();
+    std::cerr << "Frame cache: " << cacheStats.hits << " hits, " << cacheStats.misses << " misses, "
+              << cacheStats.evictions << " evictions\n";
+    std::cerr << "Read-ahead: " << readaheadFrames << " frames, " << readaheadCancelled << " cancelled\n";
+
     std::cout << "Exit code: " << ret;
     if (::rmdir(mountPoint.c_str()) != 0)
         std::cerr << "cleanup_mount: rmdir(\"" << mountPoint
@@ -0,0 +1,431 @@
+#include "DngTemplate.hpp"
+#include "PackedPixels.hpp"
+#include "Preview.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace motioncam {
+    namespace {
+        enum Tag : uint16_t {
+            NEW_SUBFILE_TYPE            = 254,
+            IMAGE_WIDTH                 = 256,
+            IMAGE_LENGTH                = 257,
+            BITS_PER_SAMPLE             = 258,
+            COMPRESSION                 = 259,
+            PHOTOMETRIC                 = 262,
+            STRIP_OFFSETS               = 273,
+            ORIENTATION                 = 274,
+            SAMPLES_PER_PIXEL           = 277,
+            ROWS_PER_STRIP              = 278,
+            STRIP_BYTE_COUNTS           = 279,
+            PLANAR_CONFIG               = 284,
+            TILE_WIDTH                  = 322,
+            TILE_LENGTH                 = 323,
+            TILE_OFFSETS                = 324,
+            TILE_BYTE_COUNTS            = 325,
+            SUB_IFDS                    = 330,
+            CFA_REPEAT_PATTERN_DIM      = 33421,
+            CFA_PATTERN                 = 33422,
+            EXPOSURE_TIME               = 33434,
+            ISO_SPEED_RATINGS           = 34855,
+            DNG_VERSION                 = 50706,
+            DNG_BACKWARD_VERSION        = 50707,
+            UNIQUE_CAMERA_MODEL         = 50708,
+            CFA_LAYOUT                  = 50711,
+            BLACK_LEVEL_REPEAT_DIM      = 50713,
+            BLACK_LEVEL                 = 50714,
+            WHITE_LEVEL                 = 50717,
+            COLOR_MATRIX1               = 50721,
+            COLOR_MATRIX2               = 50722,
+            AS_SHOT_NEUTRAL             = 50728,
+            CALIBRATION_ILLUMINANT1     = 50778,
+            CALIBRATION_ILLUMINANT2     = 50779,
+            ACTIVE_AREA                 = 50829,
+            FORWARD_MATRIX1             = 50964,
+            FORWARD_MATRIX2             = 50965,
+            OPCODE_LIST2                = 51009,
+            TIME_CODES                  = 51043,
+            FRAME_RATE                  = 51044
+        };
+    
+        const uint16_t PHOTOMETRIC_RGB = 2;
+        const uint16_t PHOTOMETRIC_CFA = 32803;
+        const uint16_t COMPRESSION_NONE = 1;
+        const uint16_t COMPRESSION_LOSSLESS_JPEG = 7;
+        const uint16_t PLANARCONFIG_CONTIG = 1;
+        const uint16_t ILLUMINANT_STANDARD_A = 17;
+        const uint16_t ILLUMINANT_D65 = 21;
+    
+        // Pixel data starts on this boundary
+        const size_t DATA_ALIGNMENT = 16;
+    
+        // Frames can have a different lens shading map each, only so many are kept serialized
+        const size_t MAX_CACHED_OPCODE_LISTS = 16;
+    
+        void put16(uint8_t* dst, const uint16_t v) {
+            dst[0] = static_cast<uint8_t>(v);
+            dst[1] = static_cast<uint8_t>(v >> 8);
+        }
+    
+        void put32(uint8_t* dst, const uint32_t v) {
+            dst[0] = static_cast<uint8_t>(v);
+            dst[1] = static_cast<uint8_t>(v >> 8);
+            dst[2] = static_cast<uint8_t>(v >> 16);
+            dst[3] = static_cast<uint8_t>(v >> 24);
+        }
+    
+        uint8_t toBcd(const int v) {
+            return static_cast<uint8_t>(((v / 10) << 4) | (v % 10));
+        }
+    
+        // Exact rational for the usual video frame rates, including the NTSC ones at n * 1000/1001
+        void frameRateToRational(const double fps, int32_t& outNumerator, int32_t& outDenominator) {
+            const double rounded = std::round(fps);
+            const double ntsc = std::round(fps * 1.001);
+            
+            if(std::fabs(fps - rounded) < 0.0002 * fps) {
+                outNumerator = static_cast<int32_t>(rounded);
+                outDenominator = 1;
+            }
+            else if(std::fabs(fps - ntsc / 1.001) < 0.0002 * fps) {
+                outNumerator = static_cast<int32_t>(ntsc * 1000);
+                outDenominator = 1001;
+            }
+            else {
+                tiff::ToSRational(static_cast<float>(fps), outNumerator, outDenominator);
+            }
+        }
+    
+        // Nanoseconds as a rational number of seconds, reduced so common shutter speeds read as 1/n
+        void exposureToRational(const int64_t nanoseconds, uint32_t& outNumerator, uint32_t& outDenominator) {
+            uint64_t numerator = static_cast<uint64_t>(std::max<int64_t>(0, nanoseconds));
+            uint64_t denominator = 1000000000;
+            
+            const uint64_t divisor = std::max<uint64_t>(1, std::gcd(numerator, denominator));
+            numerator /= divisor;
+            denominator /= divisor;
+            
+            while(numerator > UINT32_MAX) {
+                numerator /= 10;
+                denominator = std::max<uint64_t>(1, denominator / 10);
+            }
+            
+            outNumerator = static_cast<uint32_t>(numerator);
+            outDenominator = static_cast<uint32_t>(denominator);
+        }
+    }
+    
+    DngTemplate::DngTemplate(
+        const DngCameraInfo& camera,
+        const int width,
+        const int height,
+        const DngFormat& format) :
+        mWidth(width),
+        mHeight(height),
+        mFormat(format),
+        mCfa(camera.cfa),
+        mLensShading(camera.lensShading),
+        mPreviewWidth(0),
+        mPreviewHeight(0),
+        mFrameRateNumerator(1),
+        mFrameRateDenominator(1),
+        mTimecodeRate(1),
+        mDropFrame(false),
+        mAsShotNeutralOffset(0),
+        mExposureTimeOffset(0),
+        mIsoOffset(0),
+        mTimeCodesOffset(0),
+        mTileOffsetsOffset(0),
+        mTileByteCountsOffset(0),
+        mPreviewOffsetOffset(0),
+        mOpcodeList2Offset(0)
+    {
+        const uint32_t w = static_cast<uint32_t>(width);
+        const uint32_t h = static_cast<uint32_t>(height);
+        
+        // Without a frame rate the timecode counts whole seconds
+        if(camera.frameRate > 0) {
+            frameRateToRational(camera.frameRate, mFrameRateNumerator, mFrameRateDenominator);
+            
+            // SMPTE counts 29.97 as 30 with two frame numbers dropped most minutes, 59.94 as 60 with four
+            mTimecodeRate = std::max(1, static_cast<int>(std::lround(camera.frameRate)));
+            mDropFrame = mFrameRateDenominator == 1001 && mTimecodeRate % 30 == 0;
+        }
+        
+        tiff::Ifd ifd;
+        
+        ifd.setLong(NEW_SUBFILE_TYPE, 0);
+        ifd.setLong(IMAGE_WIDTH, w);
+        ifd.setLong(IMAGE_LENGTH, h);
+        ifd.setShort(BITS_PER_SAMPLE, static_cast<uint16_t>(format.bitsPerSample));
+        ifd.setShort(PHOTOMETRIC, PHOTOMETRIC_CFA);
+        ifd.setShort(SAMPLES_PER_PIXEL, 1);
+        ifd.setShort(PLANAR_CONFIG, PLANARCONFIG_CONTIG);
+        
+        const bool compressed = format.compression == DngCompression::LOSSLESS_JPEG;
+        const std::vector<uint32_t> placeholders(numTiles(), 0);
+        
+        ifd.setShort(COMPRESSION, compressed ? COMPRESSION_LOSSLESS_JPEG : COMPRESSION_NONE);
+        
+        if(tiled()) {
+            const uint32_t tileBytes = static_cast<uint32_t>(tileRowBytes() * TILE_SIZE);
+            
+            ifd.setLong(TILE_WIDTH, TILE_SIZE);
+            ifd.setLong(TILE_LENGTH, TILE_SIZE);
+            
+            // Compressed tiles are replaced by the layout of each frame
+            ifd.setLongs(TILE_BYTE_COUNTS, compressed ? placeholders : std::vector<uint32_t>(numTiles(), tileBytes));
+        }
+        else {
+            ifd.setLong(ROWS_PER_STRIP, h);
+            ifd.setLong(STRIP_BYTE_COUNTS, static_cast<uint32_t>(imageSize()));
+        }
+        
+        if(camera.orientation)
+            ifd.setShort(ORIENTATION, camera.orientation);
+        
+        ifd.setShorts(CFA_REPEAT_PATTERN_DIM, { 2, 2 });
+        ifd.setBytes(CFA_PATTERN, { camera.cfa[0], camera.cfa[1], camera.cfa[2], camera.cfa[3] });
+        ifd.setShort(CFA_LAYOUT, 1);
+        
+        ifd.setBytes(DNG_VERSION, { 1, 4, 0, 0 });
+        ifd.setBytes(DNG_BACKWARD_VERSION, { 1, 1, 0, 0 });
+        ifd.setAscii(UNIQUE_CAMERA_MODEL, "MotionCam");
+        
+        ifd.setShorts(BLACK_LEVEL_REPEAT_DIM, { 2, 2 });
+        ifd.setShorts(BLACK_LEVEL, camera.blackLevels);
+        ifd.setShort(WHITE_LEVEL, static_cast<uint16_t>(camera.whiteLevel));
+        
+        ifd.setSRationals(COLOR_MATRIX1, camera.colorMatrix1);
+        ifd.setSRationals(COLOR_MATRIX2, camera.colorMatrix2);
+        ifd.setSRationals(FORWARD_MATRIX1, camera.forwardMatrix1);
+        ifd.setSRationals(FORWARD_MATRIX2, camera.forwardMatrix2);
+        ifd.setShort(CALIBRATION_ILLUMINANT1, ILLUMINANT_D65);
+        ifd.setShort(CALIBRATION_ILLUMINANT2, ILLUMINANT_STANDARD_A);
+        
+        // Placeholders, replaced by the values of each frame
+        ifd.setRationals(AS_SHOT_NEUTRAL, { 1.0f, 1.0f, 1.0f });
+        ifd.setRationals(EXPOSURE_TIME, { 0.0f });
+        ifd.setShort(ISO_SPEED_RATINGS, 0);
+        ifd.setBytes(TIME_CODES, std::vector<uint8_t>(8, 0));
+        
+        // Written exactly once the IFD is in place
+        if(camera.frameRate > 0)
+            ifd.setSRationals(FRAME_RATE, { 0.0f });
+        
+        ifd.setLongs(ACTIVE_AREA, { 0, 0, h, w });
+        
+        // Lens shading is applied by the reader to the raw pixels
+        if(!mLensShading.empty())
+            ifd.setUndefined(OPCODE_LIST2, gainmap::OpcodeList(mLensShading, width, height));
+        
+        // The preview is a reduced resolution RGB image in a SubIFD
+        tiff::Ifd previewIfd;
+        
+        if(format.previewWidth > 0) {
+            preview::PreviewSize(width, height, format.previewWidth, mPreviewWidth, mPreviewHeight);
+            
+            previewIfd.setLong(NEW_SUBFILE_TYPE, 1);
+            previewIfd.setLong(IMAGE_WIDTH, static_cast<uint32_t>(mPreviewWidth));
+            previewIfd.setLong(IMAGE_LENGTH, static_cast<uint32_t>(mPreviewHeight));
+            previewIfd.setShorts(BITS_PER_SAMPLE, { 8, 8, 8 });
+            previewIfd.setShort(COMPRESSION, COMPRESSION_NONE);
+            previewIfd.setShort(PHOTOMETRIC, PHOTOMETRIC_RGB);
+            previewIfd.setShort(SAMPLES_PER_PIXEL, 3);
+            previewIfd.setLong(ROWS_PER_STRIP, static_cast<uint32_t>(mPreviewHeight));
+            previewIfd.setLong(STRIP_BYTE_COUNTS, static_cast<uint32_t>(previewSize()));
+            previewIfd.setShort(PLANAR_CONFIG, PLANARCONFIG_CONTIG);
+            
+            if(camera.orientation)
+                previewIfd.setShort(ORIENTATION, camera.orientation);
+            
+            // Set once the size of the header is known
+            previewIfd.setLong(STRIP_OFFSETS, 0);
+            ifd.setLong(SUB_IFDS, 0);
+        }
+        
+        // Offset of the pixels depends on the size of the IFD, the tags have a fixed size so set them last
+        if(tiled())
+            ifd.setLongs(TILE_OFFSETS, placeholders);
+        else
+            ifd.setLong(STRIP_OFFSETS, 0);
+        
+        const uint32_t ifdOffset = static_cast<uint32_t>(tiff::HEADER_SIZE);
+        const uint32_t previewIfdOffset = static_cast<uint32_t>(tiff::HEADER_SIZE + ifd.size());
+        const size_t ifdsSize = ifd.size() + (mPreviewWidth > 0 ? previewIfd.size() : 0);
+        const size_t headerSize = (tiff::HEADER_SIZE + ifdsSize + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+        
+        if(mPreviewWidth > 0) {
+            ifd.setLong(SUB_IFDS, previewIfdOffset);
+            
+            // Compressed frames replace this once the size of their tiles is known
+            previewIfd.setLong(STRIP_OFFSETS, static_cast<uint32_t>(headerSize + imageSize()));
+        }
+        
+        if(!tiled()) {
+            ifd.setLong(STRIP_OFFSETS, static_cast<uint32_t>(headerSize));
+        }
+        else if(!compressed) {
+            // Uncompressed tiles all have the same size so their offsets never change
+            std::vector<uint32_t> tileOffsets(numTiles());
+            
+            for(size_t i = 0; i < tileOffsets.size(); i++)
+                tileOffsets[i] = static_cast<uint32_t>(headerSize + i * tileRowBytes() * TILE_SIZE);
+            
+            ifd.setLongs(TILE_OFFSETS, tileOffsets);
+        }
+        
+        mHeader.assign(headerSize, 0);
+        
+        tiff::WriteHeader(mHeader.data(), ifdOffset);
+        ifd.write(mHeader.data() + ifdOffset, ifdOffset, 0);
+        
+        if(mPreviewWidth > 0) {
+            previewIfd.write(mHeader.data() + previewIfdOffset, previewIfdOffset, 0);
+            mPreviewOffsetOffset = previewIfd.valueOffset(STRIP_OFFSETS, previewIfdOffset);
+        }
+        
+        mAsShotNeutralOffset = ifd.valueOffset(AS_SHOT_NEUTRAL, ifdOffset);
+        mExposureTimeOffset = ifd.valueOffset(EXPOSURE_TIME, ifdOffset);
+        mIsoOffset = ifd.valueOffset(ISO_SPEED_RATINGS, ifdOffset);
+        mTimeCodesOffset = ifd.valueOffset(TIME_CODES, ifdOffset);
+        
+        if(!mLensShading.empty())
+            mOpcodeList2Offset = ifd.valueOffset(OPCODE_LIST2, ifdOffset);
+        
+        if(camera.frameRate > 0) {
+            const uint32_t frameRateOffset = ifd.valueOffset(FRAME_RATE, ifdOffset);
+            put32(mHeader.data() + frameRateOffset, static_cast<uint32_t>(mFrameRateNumerator));
+            put32(mHeader.data() + frameRateOffset + 4, static_cast<uint32_t>(mFrameRateDenominator));
+        }
+        
+        if(compressed) {
+            mTileOffsetsOffset = ifd.valueOffset(TILE_OFFSETS, ifdOffset);
+            mTileByteCountsOffset = ifd.valueOffset(TILE_BYTE_COUNTS, ifdOffset);
+        }
+    }
+    
+    size_t DngTemplate::rowBytes() const {
+        return packed::RowBytes(mWidth, mFormat.bitsPerSample);
+    }
+    
+    size_t DngTemplate::tileRowBytes() const {
+        return packed::RowBytes(TILE_SIZE, mFormat.bitsPerSample);
+    }
+    
+    size_t DngTemplate::imageSize() const {
+        if(tiled())
+            return tileRowBytes() * TILE_SIZE * numTiles();
+        
+        return rowBytes() * mHeight;
+    }
+    
+    void DngTemplate::writeHeader(const int64_t timeSinceStart, const nlohmann::json& frameMetadata, std::vector<uint8_t>& outHeader) const {
+        outHeader = mHeader;
+        
+        std::vector<float> asShotNeutral = frameMetadata["asShotNeutral"];
+        
+        for(size_t i = 0; i < 3 && i < asShotNeutral.size(); i++) {
+            uint32_t numerator, denominator;
+            
+            tiff::ToRational(asShotNeutral[i], numerator, denominator);
+            
+            put32(outHeader.data() + mAsShotNeutralOffset + 8*i, numerator);
+            put32(outHeader.data() + mAsShotNeutralOffset + 8*i + 4, denominator);
+        }
+        
+        uint32_t exposureNumerator, exposureDenominator;
+        exposureToRational(frameMetadata.value("exposureTime", int64_t(0)), exposureNumerator, exposureDenominator);
+        
+        put32(outHeader.data() + mExposureTimeOffset, exposureNumerator);
+        put32(outHeader.data() + mExposureTimeOffset + 4, exposureDenominator);
+        
+        const int iso = frameMetadata.value("iso", 0);
+        put16(outHeader.data() + mIsoOffset, static_cast<uint16_t>(std::min(std::max(iso, 0), 65535)));
+        
+        writeTimeCode(timeSinceStart, outHeader);
+        writeLensShading(frameMetadata, outHeader);
+    }
+    
+    void DngTemplate::writeTimeCode(const int64_t timeSinceStart, std::vector<uint8_t>& outHeader) const {
+        // SMPTE timecode of when the frame was captured, counted from zero at the first frame, so a dropped or
+        // repeated frame doesn't shift the ones after it
+        const double seconds = static_cast<double>(std::max<int64_t>(0, timeSinceStart)) * 1e-9;
+        int64_t frame = std::llround(seconds * mFrameRateNumerator / mFrameRateDenominator);
+        
+        // Drop-frame timecode skips the first frame numbers of every minute except each tenth one
+        if(mDropFrame) {
+            const int64_t dropped = mTimecodeRate / 15;
+            const int64_t framesPerMinute = 60 * mTimecodeRate - dropped;
+            const int64_t framesPerTenMinutes = 10 * framesPerMinute + dropped;
+            const int64_t remainder = frame % framesPerTenMinutes;
+            
+            frame += 9 * dropped * (frame / framesPerTenMinutes);
+            if(remainder > dropped)
+                frame += dropped * ((remainder - dropped) / framesPerMinute);
+        }
+        
+        // Rates above 30 count frames in groups, the SMPTE frame digits can't go higher, with the field flag
+        // marking the second of a pair
+        const int framesPerDigit = (mTimecodeRate + 29) / 30;
+        const int frames = static_cast<int>(frame % mTimecodeRate) / framesPerDigit;
+        const int totalSeconds = static_cast<int>((frame / mTimecodeRate) % (24 * 3600));
+        
+        uint8_t* timeCode = outHeader.data() + mTimeCodesOffset;
+        timeCode[0] = static_cast<uint8_t>(toBcd(frames) | (mDropFrame ? 0x40 : 0));
+        timeCode[1] = static_cast<uint8_t>(toBcd(totalSeconds % 60) | (framesPerDigit == 2 && (frame & 1) ? 0x80 : 0));
+        timeCode[2] = toBcd((totalSeconds / 60) % 60);
+        timeCode[3] = toBcd((totalSeconds / 3600) % 24);
+    }
+    
+    void DngTemplate::writeLensShading(const nlohmann::json& frameMetadata, std::vector<uint8_t>& outHeader) const {
+        GainMap map;
+        
+        if(mLensShading.empty() || !gainmap::Read(frameMetadata, mCfa, map))
+            return;
+        
+        // A map with a different number of points changes the size of the header
+        if(map.width != mLensShading.width || map.height != mLensShading.height)
+            return;
+        
+        std::lock_guard<std::mutex> lock(mOpcodeListsLock);
+        
+        auto it = mOpcodeLists.find(map);
+        if(it == mOpcodeLists.end()) {
+            if(mOpcodeLists.size() >= MAX_CACHED_OPCODE_LISTS)
+                mOpcodeLists.clear();
+            
+            std::vector<uint8_t> opcodeList = gainmap::OpcodeList(map, mWidth, mHeight);
+            it = mOpcodeLists.emplace(std::move(map), std::move(opcodeList)).first;
+        }
+        
+        std::memcpy(outHeader.data() + mOpcodeList2Offset, it->second.data(), it->second.size());
+    }
+    
+    void DngTemplate::writeHeader(
+        const int64_t timeSinceStart,
+        const nlohmann::json& frameMetadata,
+        const std::vector<uint32_t>& tileByteCounts,
+        std::vector<uint8_t>& outHeader) const
+    {
+        writeHeader(timeSinceStart, frameMetadata, outHeader);
+        
+        if(mFormat.compression == DngCompression::NONE)
+            return;
+        
+        uint32_t offset = static_cast<uint32_t>(headerSize());
+        
+        for(size_t i = 0; i < tileByteCounts.size() && i < static_cast<size_t>(numTiles()); i++) {
+            put32(outHeader.data() + mTileOffsetsOffset + 4*i, offset);
+            put32(outHeader.data() + mTileByteCountsOffset + 4*i, tileByteCounts[i]);
+            
+            offset += tileByteCounts[i];
+        }
+        
+        if(mPreviewWidth > 0)
+            put32(outHeader.data() + mPreviewOffsetOffset, offset);
+    }
+} // namespace motioncam
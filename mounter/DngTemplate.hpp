@@ -0,0 +1,164 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DngTemplate_hpp
+#define DngTemplate_hpp
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "GainMap.hpp"
+#include "TiffWriter.hpp"
+
+namespace motioncam {
+    // Values shared by every frame of a container
+    struct DngCameraInfo {
+        std::vector<uint16_t> blackLevels;
+        double whiteLevel = 0.0;
+        std::array<uint8_t, 4> cfa = {{0, 1, 1, 2}};
+        uint16_t orientation = 0;
+        std::vector<float> colorMatrix1;
+        std::vector<float> colorMatrix2;
+        std::vector<float> forwardMatrix1;
+        std::vector<float> forwardMatrix2;
+        
+        // Frames per second, 0 when unknown
+        double frameRate = 0.0;
+        
+        // Written as an OpcodeList2 when not empty
+        GainMap lensShading;
+    };
+    
+    enum class DngCompression {
+        NONE,
+        
+        // Tiles of lossless JPEG, DNG compression 7
+        LOSSLESS_JPEG
+    };
+    
+    // How a DNG stores its pixels
+    struct DngFormat {
+        DngCompression compression = DngCompression::NONE;
+        
+        // Uncompressed pixels below 16 bits are bit-packed, rows starting on a byte boundary
+        int bitsPerSample = 16;
+        
+        // Store uncompressed pixels in tiles rather than a single strip, compressed pixels always are
+        bool tiled = false;
+        
+        // Largest width of an 8-bit RGB preview stored in a SubIFD after the pixels, 0 for no preview
+        int previewWidth = 0;
+    };
+    
+    // The TIFF header and IFD of an uncompressed CFA DNG, built once for a given frame size. Frames
+    // only differ in a few tags, which are patched into a copy of the template. Uncompressed frames are
+    // followed by their rows of pixels or by tiles of a fixed size, compressed frames by their tiles
+    // stored back to back. The preview, when there is one, comes last.
+    class DngTemplate {
+    public:
+        // Width and height of the tiles of tiled frames
+        static constexpr int TILE_SIZE = 256;
+        
+        DngTemplate(
+            const DngCameraInfo& camera,
+            const int width,
+            const int height,
+            const DngFormat& format = DngFormat());
+        
+        int width() const { return mWidth; }
+        int height() const { return mHeight; }
+        DngCompression compression() const { return mFormat.compression; }
+        int bitsPerSample() const { return mFormat.bitsPerSample; }
+        bool tiled() const { return mFormat.tiled || mFormat.compression != DngCompression::NONE; }
+        
+        int tilesAcross() const { return (mWidth + TILE_SIZE - 1) / TILE_SIZE; }
+        int tilesDown() const { return (mHeight + TILE_SIZE - 1) / TILE_SIZE; }
+        int numTiles() const { return tilesAcross() * tilesDown(); }
+        
+        // Bytes before the pixel data
+        size_t headerSize() const { return mHeader.size(); }
+        
+        // Bytes in a row of pixels when uncompressed
+        size_t rowBytes() const;
+        
+        // Bytes in a row of an uncompressed tile, each is a slice of a row of the frame
+        size_t tileRowBytes() const;
+        
+        // Bytes of pixel data when uncompressed. Tiles past the right and bottom edges are padded
+        size_t imageSize() const;
+        
+        int previewWidth() const { return mPreviewWidth; }
+        int previewHeight() const { return mPreviewHeight; }
+        
+        // Bytes of the preview, 0 when there is none
+        size_t previewSize() const { return 3 * static_cast<size_t>(mPreviewWidth) * mPreviewHeight; }
+        
+        // Size of the complete DNG when uncompressed, compressed frames are only known once encoded
+        size_t fileSize() const { return headerSize() + imageSize() + previewSize(); }
+        
+        // Header of an uncompressed frame, the template with the values from the frame metadata filled in.
+        // timeSinceStart is the nanoseconds from the first frame of the container to this one and sets its
+        // timecode. A lens shading map in the frame metadata replaces the one of the template when it has the
+        // same number of points.
+        void writeHeader(const int64_t timeSinceStart, const nlohmann::json& frameMetadata, std::vector<uint8_t>& outHeader) const;
+        
+        // Header of a compressed frame, also filling in where each tile and the preview are from the size
+        // of every tile
+        void writeHeader(
+            const int64_t timeSinceStart,
+            const nlohmann::json& frameMetadata,
+            const std::vector<uint32_t>& tileByteCounts,
+            std::vector<uint8_t>& outHeader) const;
+        
+    private:
+        void writeLensShading(const nlohmann::json& frameMetadata, std::vector<uint8_t>& outHeader) const;
+        void writeTimeCode(const int64_t timeSinceStart, std::vector<uint8_t>& outHeader) const;
+        
+    private:
+        int mWidth;
+        int mHeight;
+        DngFormat mFormat;
+        std::array<uint8_t, 4> mCfa;
+        GainMap mLensShading;
+        std::vector<uint8_t> mHeader;
+        int mPreviewWidth;
+        int mPreviewHeight;
+        int32_t mFrameRateNumerator;
+        int32_t mFrameRateDenominator;
+        int mTimecodeRate;          // Frames a second the timecode counts, the frame rate rounded
+        bool mDropFrame;            // Timecode skips frame numbers to keep up with an NTSC frame rate
+        uint32_t mAsShotNeutralOffset;
+        uint32_t mExposureTimeOffset;
+        uint32_t mIsoOffset;
+        uint32_t mTimeCodesOffset;
+        uint32_t mTileOffsetsOffset;
+        uint32_t mTileByteCountsOffset;
+        uint32_t mPreviewOffsetOffset;
+        uint32_t mOpcodeList2Offset;
+        
+        // Opcode lists of the lens shading maps of frames, each serialized once
+        mutable std::map<GainMap, std::vector<uint8_t>> mOpcodeLists;
+        mutable std::mutex mOpcodeListsLock;
+    };
+} // namespace motioncam
+
+#endif /* DngTemplate_hpp */
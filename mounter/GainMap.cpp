@@ -0,0 +1,137 @@
+#include "GainMap.hpp"
+
+#include <cmath>
+#include <cstring>
+
+namespace motioncam {
+    namespace {
+        const uint32_t OPCODE_GAIN_MAP = 9;
+        const uint32_t OPCODE_DNG_VERSION = 0x01030000;
+        const uint32_t OPCODE_FLAG_OPTIONAL = 1;
+
+        // Opcode lists are big endian whatever the byte order of the file
+        void putBE32(std::vector<uint8_t>& out, const uint32_t v) {
+            out.push_back(static_cast<uint8_t>(v >> 24));
+            out.push_back(static_cast<uint8_t>(v >> 16));
+            out.push_back(static_cast<uint8_t>(v >> 8));
+            out.push_back(static_cast<uint8_t>(v));
+        }
+
+        void putBEFloat(std::vector<uint8_t>& out, const float v) {
+            uint32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            putBE32(out, bits);
+        }
+
+        void putBEDouble(std::vector<uint8_t>& out, const double v) {
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            putBE32(out, static_cast<uint32_t>(bits >> 32));
+            putBE32(out, static_cast<uint32_t>(bits));
+        }
+    }
+
+    bool GainMap::operator<(const GainMap& other) const {
+        if(width != other.width)
+            return width < other.width;
+        if(height != other.height)
+            return height < other.height;
+        return gains < other.gains;
+    }
+
+    namespace gainmap {
+        bool Read(const nlohmann::json& metadata, const std::array<uint8_t, 4>& cfa, GainMap& outMap) {
+            if(!metadata.is_object() || !metadata.contains("lensShadingMap"))
+                return false;
+
+            const nlohmann::json& channels = metadata["lensShadingMap"];
+            const nlohmann::json& width = metadata.contains("lensShadingMapWidth") ? metadata["lensShadingMapWidth"] : nlohmann::json();
+            const nlohmann::json& height = metadata.contains("lensShadingMapHeight") ? metadata["lensShadingMapHeight"] : nlohmann::json();
+
+            if(!channels.is_array() || channels.size() != 4 || !width.is_number_integer() || !height.is_number_integer())
+                return false;
+
+            GainMap map;
+            map.width = width.get<int>();
+            map.height = height.get<int>();
+
+            // A single point can't be placed on both edges of the frame
+            if(map.width < 2 || map.height < 2)
+                return false;
+
+            const size_t numPoints = static_cast<size_t>(map.width) * map.height;
+            std::array<std::vector<float>, 4> reported;
+
+            for(size_t c = 0; c < 4; c++) {
+                if(!channels[c].is_array() || channels[c].size() != numPoints)
+                    return false;
+
+                reported[c].reserve(numPoints);
+
+                for(const auto& v : channels[c]) {
+                    if(!v.is_number())
+                        return false;
+
+                    const float gain = v.get<float>();
+                    if(!std::isfinite(gain) || gain <= 0.0f)
+                        return false;
+
+                    reported[c].push_back(gain);
+                }
+            }
+
+            // Match each position of the colour filter pattern to its channel
+            for(int k = 0; k < 4; k++) {
+                if(cfa[k] == 0)
+                    map.gains[k] = reported[0];
+                else if(cfa[k] == 2)
+                    map.gains[k] = reported[3];
+                else
+                    map.gains[k] = reported[k < 2 ? 1 : 2];
+            }
+
+            outMap = std::move(map);
+            return true;
+        }
+
+        std::vector<uint8_t> OpcodeList(const GainMap& map, const int width, const int height) {
+            const size_t numPoints = static_cast<size_t>(map.width) * map.height;
+            const uint32_t paramsSize = static_cast<uint32_t>(76 + 4 * numPoints);
+
+            std::vector<uint8_t> out;
+            out.reserve(4 + 4 * (16 + paramsSize));
+
+            putBE32(out, 4);
+
+            for(int k = 0; k < 4; k++) {
+                putBE32(out, OPCODE_GAIN_MAP);
+                putBE32(out, OPCODE_DNG_VERSION);
+                putBE32(out, OPCODE_FLAG_OPTIONAL);
+                putBE32(out, paramsSize);
+
+                // Area as top, left, bottom, right, stepping over the other positions of the pattern
+                putBE32(out, static_cast<uint32_t>(k / 2));
+                putBE32(out, static_cast<uint32_t>(k % 2));
+                putBE32(out, static_cast<uint32_t>(height));
+                putBE32(out, static_cast<uint32_t>(width));
+                putBE32(out, 0);    // Plane
+                putBE32(out, 1);    // Planes
+                putBE32(out, 2);    // Row pitch
+                putBE32(out, 2);    // Column pitch
+
+                putBE32(out, static_cast<uint32_t>(map.height));
+                putBE32(out, static_cast<uint32_t>(map.width));
+                putBEDouble(out, 1.0 / (map.height - 1));
+                putBEDouble(out, 1.0 / (map.width - 1));
+                putBEDouble(out, 0.0);
+                putBEDouble(out, 0.0);
+                putBE32(out, 1);    // Map planes
+
+                for(float gain : map.gains[k])
+                    putBEFloat(out, gain);
+            }
+
+            return out;
+        }
+    } // namespace gainmap
+} // namespace motioncam
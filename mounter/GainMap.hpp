@@ -0,0 +1,49 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GainMap_hpp
+#define GainMap_hpp
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace motioncam {
+    // A lens shading map, one grid of gains for each position of the 2x2 colour filter pattern in row major
+    // order. The grids cover the whole frame with their first and last points on its edges.
+    struct GainMap {
+        int width = 0;
+        int height = 0;
+        std::array<std::vector<float>, 4> gains;
+
+        bool empty() const { return width == 0 || height == 0; }
+        bool operator<(const GainMap& other) const;
+    };
+
+    namespace gainmap {
+        // Reads the "lensShadingMap" of container or frame metadata, four grids of
+        // "lensShadingMapWidth" x "lensShadingMapHeight" gains in [R, G even row, G odd row, B] order as the
+        // camera reports them. Returns false, leaving outMap untouched, when there is no map or it is malformed.
+        bool Read(const nlohmann::json& metadata, const std::array<uint8_t, 4>& cfa, GainMap& outMap);
+
+        // An OpcodeList2 holding a GainMap opcode for each colour filter position of a width x height frame
+        std::vector<uint8_t> OpcodeList(const GainMap& map, const int width, const int height);
+    } // namespace gainmap
+} // namespace motioncam
+
+#endif /* GainMap_hpp */
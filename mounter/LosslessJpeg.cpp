@@ -0,0 +1,430 @@
+#include "LosslessJpeg.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <simde/x86/ssse3.h>
+
+namespace motioncam {
+    namespace ljpeg {
+        namespace {
+            // Difference categories 0-16, plus the reserved symbol that keeps codes from being all ones
+            const int NUM_CATEGORIES = 17;
+            const int MAX_CODE_LENGTH = 16;
+
+            const int PRECISION = 16;
+            const int NUM_COMPONENTS = 2;
+            const int PREDICTOR_LEFT = 1;
+
+            // At most 31 bits a sample, doubled by stuffing
+            const size_t MAX_SAMPLE_BYTES = 8;
+
+            const uint8_t MARKER_SOI = 0xD8;
+            const uint8_t MARKER_SOF3 = 0xC3;
+            const uint8_t MARKER_DHT = 0xC4;
+            const uint8_t MARKER_SOS = 0xDA;
+            const uint8_t MARKER_EOI = 0xD9;
+
+            struct HuffmanTable {
+                uint8_t bits[MAX_CODE_LENGTH + 1] = {};
+                uint8_t values[NUM_CATEGORIES] = {};
+                int numValues = 0;
+                uint16_t code[NUM_CATEGORIES] = {};
+                uint8_t length[NUM_CATEGORIES] = {};
+            };
+
+            // Appends bits most significant first, stuffing a zero byte after every 0xFF. Bytes are written
+            // through a pointer, call ensure() with the most bytes the next puts can write.
+            class BitWriter {
+            public:
+                BitWriter(std::vector<uint8_t>& out) : mOut(out), mSize(out.size()), mBits(0), mCount(0) {}
+
+                void ensure(const size_t bytes) {
+                    if(mOut.size() < mSize + bytes)
+                        mOut.resize(std::max(mOut.size() * 2, mSize + bytes));
+                }
+
+                void put(const uint32_t bits, const int count) {
+                    mBits = (mBits << count) | bits;
+                    mCount += count;
+
+                    if(mCount >= 32) {
+                        mCount -= 32;
+
+                        const uint32_t word = static_cast<uint32_t>(mBits >> mCount);
+                        uint8_t* dst = mOut.data() + mSize;
+
+                        // Fast path when none of the four bytes is 0xFF
+                        if(((word & 0x80808080u) & ((word & 0x7F7F7F7Fu) + 0x01010101u)) == 0) {
+                            dst[0] = static_cast<uint8_t>(word >> 24);
+                            dst[1] = static_cast<uint8_t>(word >> 16);
+                            dst[2] = static_cast<uint8_t>(word >> 8);
+                            dst[3] = static_cast<uint8_t>(word);
+                            mSize += 4;
+                        }
+                        else {
+                            for(int shift = 24; shift >= 0; shift -= 8)
+                                putByte(static_cast<uint8_t>(word >> shift));
+                        }
+                    }
+                }
+
+                // Writes out what is left, padding the last byte with ones
+                void flush() {
+                    ensure(16);
+
+                    if(mCount % 8 != 0)
+                        put((1u << (8 - mCount % 8)) - 1, 8 - mCount % 8);
+
+                    while(mCount >= 8) {
+                        mCount -= 8;
+                        putByte(static_cast<uint8_t>(mBits >> mCount));
+                    }
+
+                    mOut.resize(mSize);
+                }
+
+            private:
+                void putByte(const uint8_t b) {
+                    mOut[mSize++] = b;
+                    if(b == 0xFF)
+                        mOut[mSize++] = 0;
+                }
+
+            private:
+                std::vector<uint8_t>& mOut;
+                size_t mSize;
+                uint64_t mBits;
+                int mCount;
+            };
+
+            void PutMarker(std::vector<uint8_t>& out, const uint8_t marker) {
+                out.push_back(0xFF);
+                out.push_back(marker);
+            }
+
+            void Put16(std::vector<uint8_t>& out, const int v) {
+                out.push_back(static_cast<uint8_t>(v >> 8));
+                out.push_back(static_cast<uint8_t>(v));
+            }
+
+            // Number of bits in the magnitude of a difference. A difference of -32768 is read as the
+            // magnitude 32768, which is the special category 16 that has no extra bits.
+            inline int Category(const int16_t diff) {
+                const uint32_t magnitude = static_cast<uint16_t>(diff == -32768 ? 32768 : std::abs(diff));
+
+                return magnitude == 0 ? 0 : 32 - __builtin_clz(magnitude);
+            }
+
+            // Optimal code lengths limited to 16 bits, following Annex K.2 of the JPEG specification
+            void BuildHuffmanTable(const uint32_t (&histogram)[NUM_CATEGORIES], HuffmanTable& table) {
+                int64_t freq[NUM_CATEGORIES + 1];
+                int codeSize[NUM_CATEGORIES + 1];
+                int others[NUM_CATEGORIES + 1];
+
+                for(int i = 0; i < NUM_CATEGORIES; i++)
+                    freq[i] = histogram[i];
+
+                freq[NUM_CATEGORIES] = 1;
+
+                std::fill(codeSize, codeSize + NUM_CATEGORIES + 1, 0);
+                std::fill(others, others + NUM_CATEGORIES + 1, -1);
+
+                while(true) {
+                    // The two least frequent symbols, preferring the larger value on ties
+                    int v1 = -1, v2 = -1;
+
+                    for(int i = 0; i <= NUM_CATEGORIES; i++) {
+                        if(freq[i] > 0 && (v1 < 0 || freq[i] <= freq[v1]))
+                            v1 = i;
+                    }
+
+                    for(int i = 0; i <= NUM_CATEGORIES; i++) {
+                        if(freq[i] > 0 && i != v1 && (v2 < 0 || freq[i] <= freq[v2]))
+                            v2 = i;
+                    }
+
+                    if(v2 < 0)
+                        break;
+
+                    freq[v1] += freq[v2];
+                    freq[v2] = 0;
+
+                    codeSize[v1]++;
+                    while(others[v1] >= 0) {
+                        v1 = others[v1];
+                        codeSize[v1]++;
+                    }
+
+                    others[v1] = v2;
+
+                    codeSize[v2]++;
+                    while(others[v2] >= 0) {
+                        v2 = others[v2];
+                        codeSize[v2]++;
+                    }
+                }
+
+                int bits[2 * MAX_CODE_LENGTH + 1] = {};
+
+                for(int i = 0; i <= NUM_CATEGORIES; i++) {
+                    if(codeSize[i] > 0)
+                        bits[codeSize[i]]++;
+                }
+
+                // Move codes that are too long up the tree
+                for(int i = 2 * MAX_CODE_LENGTH; i > MAX_CODE_LENGTH; i--) {
+                    while(bits[i] > 0) {
+                        int j = i - 2;
+                        while(bits[j] == 0)
+                            j--;
+
+                        bits[i] -= 2;
+                        bits[i - 1]++;
+                        bits[j + 1] += 2;
+                        bits[j]--;
+                    }
+                }
+
+                // Drop the reserved symbol, it has the longest code
+                int longest = MAX_CODE_LENGTH;
+                while(bits[longest] == 0)
+                    longest--;
+                bits[longest]--;
+
+                for(int i = 1; i <= MAX_CODE_LENGTH; i++)
+                    table.bits[i] = static_cast<uint8_t>(bits[i]);
+
+                // Symbols sorted by code length
+                table.numValues = 0;
+
+                for(int len = 1; len <= 2 * MAX_CODE_LENGTH; len++) {
+                    for(int i = 0; i < NUM_CATEGORIES; i++) {
+                        if(codeSize[i] == len)
+                            table.values[table.numValues++] = static_cast<uint8_t>(i);
+                    }
+                }
+
+                // Canonical codes in that order
+                uint16_t code = 0;
+                int k = 0;
+
+                for(int len = 1; len <= MAX_CODE_LENGTH; len++) {
+                    for(int i = 0; i < table.bits[len]; i++, k++) {
+                        table.code[table.values[k]] = code++;
+                        table.length[table.values[k]] = static_cast<uint8_t>(len);
+                    }
+
+                    code <<= 1;
+                }
+            }
+
+            // Copies the tile out of the frame, padding it with the closest pixels of the same colour
+            void GatherTile(
+                const uint16_t* src,
+                const size_t stride,
+                const int width,
+                const int height,
+                const int tileWidth,
+                const int tileHeight,
+                uint16_t* dst)
+            {
+                const int copyWidth = std::min(width, tileWidth);
+
+                for(int y = 0; y < tileHeight; y++) {
+                    uint16_t* row = dst + static_cast<size_t>(y) * tileWidth;
+
+                    if(y < height) {
+                        std::memcpy(row, src + y * stride, copyWidth * sizeof(uint16_t));
+
+                        for(int x = copyWidth; x < tileWidth; x++)
+                            row[x] = row[x >= 2 ? x - 2 : 0];
+                    }
+                    else {
+                        const int sameColour = y >= 2 ? y - 2 : 0;
+
+                        std::memcpy(row, dst + static_cast<size_t>(sameColour) * tileWidth, tileWidth * sizeof(uint16_t));
+                    }
+                }
+            }
+
+            // Bit lengths of the magnitudes of eight differences, from the exponent of their float value
+            inline simde__m128i Categories(const simde__m128i diffs) {
+                const simde__m128i magnitude = simde_mm_abs_epi16(diffs);
+                const simde__m128i zero = simde_mm_setzero_si128();
+                const simde__m128i bias = simde_mm_set1_epi32(126);
+
+                const simde__m128i lo = simde_mm_castps_si128(simde_mm_cvtepi32_ps(simde_mm_unpacklo_epi16(magnitude, zero)));
+                const simde__m128i hi = simde_mm_castps_si128(simde_mm_cvtepi32_ps(simde_mm_unpackhi_epi16(magnitude, zero)));
+
+                // Zero has a zero exponent and saturates to category 0
+                const simde__m128i loBits = simde_mm_sub_epi32(simde_mm_srli_epi32(lo, 23), bias);
+                const simde__m128i hiBits = simde_mm_sub_epi32(simde_mm_srli_epi32(hi, 23), bias);
+
+                return simde_mm_max_epi16(simde_mm_packs_epi32(loBits, hiBits), zero);
+            }
+
+            // Differences to the predicted values and their categories. Each component predicts from the pixel
+            // two to the left, except the start of a row which predicts from the row above, or from the middle
+            // of the range on the first row.
+            void Predict(
+                const uint16_t* pixels,
+                const int tileWidth,
+                const int tileHeight,
+                int16_t* diffs,
+                uint8_t* categories)
+            {
+                for(int y = 0; y < tileHeight; y++) {
+                    const uint16_t* row = pixels + static_cast<size_t>(y) * tileWidth;
+                    int16_t* out = diffs + static_cast<size_t>(y) * tileWidth;
+                    uint8_t* outCategories = categories + static_cast<size_t>(y) * tileWidth;
+
+                    for(int x = 0; x < NUM_COMPONENTS; x++) {
+                        const int predicted = y == 0 ? (1 << (PRECISION - 1)) : row[x - tileWidth];
+
+                        out[x] = static_cast<int16_t>(row[x] - predicted);
+                        outCategories[x] = static_cast<uint8_t>(Category(out[x]));
+                    }
+
+                    int x = NUM_COMPONENTS;
+
+                    for(; x + 8 <= tileWidth; x += 8) {
+                        const simde__m128i cur = simde_mm_loadu_si128(reinterpret_cast<const simde__m128i*>(row + x));
+                        const simde__m128i left = simde_mm_loadu_si128(reinterpret_cast<const simde__m128i*>(row + x - 2));
+                        const simde__m128i diff = simde_mm_sub_epi16(cur, left);
+
+                        simde_mm_storeu_si128(reinterpret_cast<simde__m128i*>(out + x), diff);
+                        simde_mm_storel_epi64(
+                            reinterpret_cast<simde__m128i*>(outCategories + x),
+                            simde_mm_packus_epi16(Categories(diff), simde_mm_setzero_si128()));
+                    }
+
+                    for(; x < tileWidth; x++) {
+                        out[x] = static_cast<int16_t>(row[x] - row[x - 2]);
+                        outCategories[x] = static_cast<uint8_t>(Category(out[x]));
+                    }
+                }
+            }
+        } // unnamed namespace
+
+        void EncodeTile(
+            const uint16_t* src,
+            const size_t stride,
+            const int width,
+            const int height,
+            const int tileWidth,
+            const int tileHeight,
+            std::vector<uint8_t>& out)
+        {
+            const size_t numPixels = static_cast<size_t>(tileWidth) * tileHeight;
+
+            std::vector<uint16_t> pixels(numPixels);
+            std::vector<int16_t> diffs(numPixels);
+            std::vector<uint8_t> categories(numPixels);
+
+            GatherTile(src, stride, width, height, tileWidth, tileHeight, pixels.data());
+            Predict(pixels.data(), tileWidth, tileHeight, diffs.data(), categories.data());
+
+            // One table for both components, fitted to this tile. Counted into four histograms so
+            // consecutive increments don't wait on each other.
+            uint32_t counts[4][NUM_CATEGORIES] = {};
+            size_t i = 0;
+
+            for(; i + 4 <= numPixels; i += 4) {
+                counts[0][categories[i]]++;
+                counts[1][categories[i + 1]]++;
+                counts[2][categories[i + 2]]++;
+                counts[3][categories[i + 3]]++;
+            }
+
+            for(; i < numPixels; i++)
+                counts[0][categories[i]]++;
+
+            uint32_t histogram[NUM_CATEGORIES];
+
+            for(int c = 0; c < NUM_CATEGORIES; c++)
+                histogram[c] = counts[0][c] + counts[1][c] + counts[2][c] + counts[3][c];
+
+            HuffmanTable table;
+            BuildHuffmanTable(histogram, table);
+
+            // Code of each category shifted past its extra bits. Category 16 has no extra bits.
+            uint32_t prefix[NUM_CATEGORIES];
+            uint32_t extraMask[NUM_CATEGORIES];
+            int totalBits[NUM_CATEGORIES];
+
+            for(int c = 0; c < NUM_CATEGORIES; c++) {
+                const int extraBits = c < 16 ? c : 0;
+
+                prefix[c] = static_cast<uint32_t>(table.code[c]) << extraBits;
+                extraMask[c] = (1u << extraBits) - 1;
+                totalBits[c] = table.length[c] + extraBits;
+            }
+
+            out.clear();
+            out.reserve(numPixels * sizeof(uint16_t) / 2);
+
+            PutMarker(out, MARKER_SOI);
+
+            // Frame header, two components of tileWidth/2 samples per row
+            PutMarker(out, MARKER_SOF3);
+            Put16(out, 8 + 3 * NUM_COMPONENTS);
+            out.push_back(PRECISION);
+            Put16(out, tileHeight);
+            Put16(out, tileWidth / NUM_COMPONENTS);
+            out.push_back(NUM_COMPONENTS);
+
+            for(int c = 0; c < NUM_COMPONENTS; c++) {
+                out.push_back(static_cast<uint8_t>(c));
+                out.push_back(0x11);
+                out.push_back(0);
+            }
+
+            PutMarker(out, MARKER_DHT);
+            Put16(out, 2 + 1 + MAX_CODE_LENGTH + table.numValues);
+            out.push_back(0);
+            out.insert(out.end(), table.bits + 1, table.bits + MAX_CODE_LENGTH + 1);
+            out.insert(out.end(), table.values, table.values + table.numValues);
+
+            // Scan header, both components use table 0
+            PutMarker(out, MARKER_SOS);
+            Put16(out, 6 + 2 * NUM_COMPONENTS);
+            out.push_back(NUM_COMPONENTS);
+
+            for(int c = 0; c < NUM_COMPONENTS; c++) {
+                out.push_back(static_cast<uint8_t>(c));
+                out.push_back(0);
+            }
+
+            out.push_back(PREDICTOR_LEFT);
+            out.push_back(0);
+            out.push_back(0);
+
+            BitWriter writer(out);
+
+            const size_t maxRowBytes = static_cast<size_t>(tileWidth) * MAX_SAMPLE_BYTES;
+
+            for(int y = 0; y < tileHeight; y++) {
+                const int16_t* rowDiffs = diffs.data() + static_cast<size_t>(y) * tileWidth;
+                const uint8_t* rowCategories = categories.data() + static_cast<size_t>(y) * tileWidth;
+
+                writer.ensure(maxRowBytes);
+
+                for(int x = 0; x < tileWidth; x++) {
+                    const int category = rowCategories[x];
+
+                    // Negative differences are sent as diff - 1
+                    int diff = rowDiffs[x];
+                    diff += diff >> 31;
+
+                    writer.put(prefix[category] | (static_cast<uint32_t>(diff) & extraMask[category]), totalBits[category]);
+                }
+            }
+
+            writer.flush();
+
+            PutMarker(out, MARKER_EOI);
+        }
+    } // namespace ljpeg
+} // namespace motioncam
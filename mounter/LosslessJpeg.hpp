@@ -0,0 +1,41 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LosslessJpeg_hpp
+#define LosslessJpeg_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace motioncam {
+    namespace ljpeg {
+        // Encodes a tileWidth x tileHeight tile of 16-bit CFA pixels as a lossless JPEG (SOF3, predictor 1)
+        // with two components, so every JPEG row holds one row of the tile in the layout DNG readers expect
+        // for compression 7. src holds width x height pixels with rows stride pixels apart. When the tile is
+        // larger than that, the rest is filled by repeating the closest pixel of the same colour.
+        void EncodeTile(
+            const uint16_t* src,
+            const size_t stride,
+            const int width,
+            const int height,
+            const int tileWidth,
+            const int tileHeight,
+            std::vector<uint8_t>& out);
+    } // namespace ljpeg
+} // namespace motioncam
+
+#endif /* LosslessJpeg_hpp */
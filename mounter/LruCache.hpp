@@ -0,0 +1,170 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LruCache_hpp
+#define LruCache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace motioncam {
+    // Shared values kept within a budget of bytes, evicting the least recently used first. Each value is charged
+    // the bytes it was last given, which can change as it fills up. Values are shared so an evicted one lives on
+    // until its last user lets go of it. The most recently used value is never evicted, even when it is over
+    // budget on its own, and neither is a value still being filled in, one that hasn't been resized since it was
+    // inserted.
+    template<typename Key, typename Value, typename Hash = std::hash<Key>>
+    class LruCache {
+    public:
+        struct Stats {
+            uint64_t hits;          // Lookups that found a value
+            uint64_t misses;        // Lookups that had to insert one
+            uint64_t evictions;     // Values dropped to stay within budget
+            size_t bytes;           // Bytes charged to the values held
+            size_t entries;         // Values held
+        };
+
+        LruCache(const size_t maxBytes) :
+            mMaxBytes(maxBytes), mBytes(0), mHits(0), mMisses(0), mEvictions(0) {}
+
+        LruCache(const LruCache&) = delete;
+        LruCache& operator=(const LruCache&) = delete;
+
+        // The value under key, inserting a default constructed one charged nothing when there is none. Either
+        // way it becomes the most recently used. outInserted tells the caller it has to fill the value in.
+        std::shared_ptr<Value> findOrInsert(const Key& key, bool& outInserted) {
+            std::lock_guard<std::mutex> lock(mLock);
+
+            auto it = mIndex.find(key);
+            if(it != mIndex.end()) {
+                mEntries.splice(mEntries.begin(), mEntries, it->second);
+                mHits++;
+                outInserted = false;
+                return it->second->value;
+            }
+
+            mEntries.push_front(Entry{ key, std::make_shared<Value>(), 0, true });
+            mIndex.emplace(key, mEntries.begin());
+            mMisses++;
+            outInserted = true;
+            return mEntries.front().value;
+        }
+
+        // Charge bytes to the value under key, if it is still the one held, and evict what no longer fits
+        void resize(const Key& key, const Value* value, const size_t bytes) {
+            std::vector<std::shared_ptr<Value>> evicted;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+
+                auto it = mIndex.find(key);
+                if(it == mIndex.end() || it->second->value.get() != value)
+                    return;
+
+                mBytes = mBytes - it->second->bytes + bytes;
+                it->second->bytes = bytes;
+                it->second->filling = false;
+
+                evict(evicted);
+            }
+
+            // Values are freed once unlocked
+        }
+
+        // Drop the value under key, if it is still the one held
+        void erase(const Key& key, const Value* value) {
+            std::shared_ptr<Value> erased;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+
+                auto it = mIndex.find(key);
+                if(it == mIndex.end() || it->second->value.get() != value)
+                    return;
+
+                erased = std::move(it->second->value);
+                mBytes -= it->second->bytes;
+                mEntries.erase(it->second);
+                mIndex.erase(it);
+            }
+        }
+
+        void setMaxBytes(const size_t maxBytes) {
+            std::vector<std::shared_ptr<Value>> evicted;
+            {
+                std::lock_guard<std::mutex> lock(mLock);
+
+                mMaxBytes = maxBytes;
+                evict(evicted);
+            }
+        }
+
+        size_t maxBytes() const {
+            std::lock_guard<std::mutex> lock(mLock);
+
+            return mMaxBytes;
+        }
+
+        Stats stats() const {
+            std::lock_guard<std::mutex> lock(mLock);
+
+            return Stats{ mHits, mMisses, mEvictions, mBytes, mEntries.size() };
+        }
+
+    private:
+        struct Entry {
+            Key key;
+            std::shared_ptr<Value> value;
+            size_t bytes;
+            bool filling;   // Inserted and not resized yet
+        };
+
+        void evict(std::vector<std::shared_ptr<Value>>& outEvicted) {
+            if(mEntries.empty())
+                return;
+
+            // Evicting a value still being filled in would have the next reader fill in another copy of it
+            auto it = mEntries.end();
+            while(mBytes > mMaxBytes && --it != mEntries.begin()) {
+                if(it->filling)
+                    continue;
+
+                outEvicted.push_back(std::move(it->value));
+                mBytes -= it->bytes;
+                mIndex.erase(it->key);
+                it = mEntries.erase(it);
+                mEvictions++;
+            }
+        }
+
+    private:
+        size_t mMaxBytes;
+        std::list<Entry> mEntries;  // Most recently used first
+        std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> mIndex;
+        size_t mBytes;
+        uint64_t mHits;
+        uint64_t mMisses;
+        uint64_t mEvictions;
+        mutable std::mutex mLock;
+    };
+} // namespace motioncam
+
+#endif /* LruCache_hpp */
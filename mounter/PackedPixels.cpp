@@ -0,0 +1,104 @@
+#include "PackedPixels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <simde/x86/sse2.h>
+
+namespace motioncam {
+    namespace packed {
+        namespace {
+            // Eight pixels become BITS bytes. Pairs of pixels are joined with a multiply-add and pairs of pairs
+            // with a 64-bit shift, which leaves each 64-bit lane holding BITS/2 bytes that are byte swapped into
+            // big endian order. Only SSE2 is used so it stays native on every x86-64 CPU and maps onto NEON.
+            template<int BITS>
+            void PackRowSIMD(const uint16_t* src, const int width, uint8_t* dst, int& x, size_t& outBytes) {
+                const int BYTES_PER_LANE = BITS / 2;
+
+                const simde__m128i maxValue = simde_mm_set1_epi16(static_cast<int16_t>((1 << BITS) - 1));
+                const simde__m128i pairMultiplier = simde_mm_set1_epi32((1 << 16) | (1 << BITS));
+                const simde__m128i lowLane = simde_mm_set_epi32(0, 0, -1, -1);
+                const simde__m128i lowHalves = simde_mm_set_epi32(0, -1, 0, -1);
+
+                uint8_t packed[16];
+
+                for(; x + 8 <= width; x += 8) {
+                    simde__m128i pixels = simde_mm_loadu_si128(reinterpret_cast<const simde__m128i*>(src + x));
+
+                    // Unsigned min without SSE4.1
+                    pixels = simde_mm_sub_epi16(pixels, simde_mm_subs_epu16(pixels, maxValue));
+
+                    const simde__m128i pairs = simde_mm_madd_epi16(pixels, pairMultiplier);
+
+                    // Join the pairs at the top of each lane
+                    simde__m128i quads = simde_mm_or_si128(
+                        simde_mm_slli_epi64(simde_mm_and_si128(pairs, lowHalves), 64 - 2 * BITS),
+                        simde_mm_slli_epi64(simde_mm_srli_epi64(pairs, 32), 64 - 4 * BITS));
+
+                    // Byte swap the lanes, the packed bytes now start each lane
+                    quads = simde_mm_shufflelo_epi16(quads, SIMDE_MM_SHUFFLE(0, 1, 2, 3));
+                    quads = simde_mm_shufflehi_epi16(quads, SIMDE_MM_SHUFFLE(0, 1, 2, 3));
+                    quads = simde_mm_or_si128(simde_mm_slli_epi16(quads, 8), simde_mm_srli_epi16(quads, 8));
+
+                    // Move the bytes of the second lane up against those of the first
+                    quads = simde_mm_or_si128(
+                        simde_mm_and_si128(quads, lowLane),
+                        simde_mm_srli_si128(simde_mm_andnot_si128(lowLane, quads), 8 - BYTES_PER_LANE));
+
+                    simde_mm_storeu_si128(reinterpret_cast<simde__m128i*>(packed), quads);
+
+                    std::memcpy(dst + outBytes, packed, BITS);
+                    outBytes += BITS;
+                }
+            }
+        }
+
+        int BitsForWhiteLevel(const double whiteLevel) {
+            for(int bits = 10; bits < 16; bits += 2) {
+                if(whiteLevel <= (1 << bits) - 1)
+                    return bits;
+            }
+
+            return 16;
+        }
+
+        size_t RowBytes(const int width, const int bits) {
+            return (static_cast<size_t>(width) * bits + 7) / 8;
+        }
+
+        void PackRow(const uint16_t* src, const int width, const int bits, uint8_t* dst) {
+            if(bits == 16) {
+                std::memcpy(dst, src, width * sizeof(uint16_t));
+                return;
+            }
+
+            int x = 0;
+            size_t outBytes = 0;
+
+            if(bits == 10)
+                PackRowSIMD<10>(src, width, dst, x, outBytes);
+            else if(bits == 12)
+                PackRowSIMD<12>(src, width, dst, x, outBytes);
+            else if(bits == 14)
+                PackRowSIMD<14>(src, width, dst, x, outBytes);
+
+            // Whatever is left a pixel at a time, padding the last byte with zeros
+            const uint32_t maxValue = (1u << bits) - 1;
+            uint32_t buffer = 0;
+            int count = 0;
+
+            for(; x < width; x++) {
+                buffer = (buffer << bits) | std::min<uint32_t>(src[x], maxValue);
+                count += bits;
+
+                while(count >= 8) {
+                    count -= 8;
+                    dst[outBytes++] = static_cast<uint8_t>(buffer >> count);
+                }
+            }
+
+            if(count > 0)
+                dst[outBytes] = static_cast<uint8_t>(buffer << (8 - count));
+        }
+    } // namespace packed
+} // namespace motioncam
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PackedPixels_hpp
+#define PackedPixels_hpp
+
+#include <cstddef>
+#include <cstdint>
+
+namespace motioncam {
+    namespace packed {
+        // Smallest of 10, 12, 14 or 16 bits that holds every value up to whiteLevel
+        int BitsForWhiteLevel(const double whiteLevel);
+
+        // Bytes in a row of width pixels of the given bit depth, rows start on a byte boundary
+        size_t RowBytes(const int width, const int bits);
+
+        // Packs a row of pixels into RowBytes(width, bits) bytes, most significant bit first as TIFF
+        // expects. Values that don't fit in bits are clamped to the largest one that does.
+        void PackRow(const uint16_t* src, const int width, const int bits, uint8_t* dst);
+    } // namespace packed
+} // namespace motioncam
+
+#endif /* PackedPixels_hpp */
@@ -0,0 +1,203 @@
+#include "Preview.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <simde/x86/sse2.h>
+
+namespace motioncam {
+    namespace preview {
+        namespace {
+            const int GAMMA_LUT_SIZE = 4096;
+
+            // XYZ (D50) to linear sRGB, Bradford adapted
+            const float XYZ_TO_SRGB[9] = {
+                 3.1338561f, -1.6168667f, -0.4906146f,
+                -0.9787684f,  1.9161415f,  0.0334540f,
+                 0.0719453f, -0.2289914f,  1.4052427f
+            };
+
+            // Linear [0, 1] in GAMMA_LUT_SIZE steps to 8-bit sRGB
+            const uint8_t* GammaLut() {
+                static const std::vector<uint8_t> lut = []() {
+                    std::vector<uint8_t> values(GAMMA_LUT_SIZE);
+
+                    for(int i = 0; i < GAMMA_LUT_SIZE; i++) {
+                        const float v = i / static_cast<float>(GAMMA_LUT_SIZE - 1);
+                        const float s = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+
+                        values[i] = static_cast<uint8_t>(std::lround(std::min(1.0f, s) * 255.0f));
+                    }
+
+                    return values;
+                }();
+
+                return lut.data();
+            }
+
+            int Scale(const int width, const int maxWidth) {
+                return std::max(1, (width / 2 + maxWidth - 1) / std::max(1, maxWidth));
+            }
+
+            // White balanced camera RGB to linear sRGB. Falls back to white balance alone when the camera
+            // has no forward matrix.
+            void ColorMatrix(const DngCameraInfo& camera, const std::vector<float>& asShotNeutral, float* out) {
+                float cameraToSrgb[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+
+                if(camera.forwardMatrix1.size() == 9) {
+                    const std::vector<float>& fm = camera.forwardMatrix1;
+
+                    for(int i = 0; i < 3; i++) {
+                        for(int j = 0; j < 3; j++) {
+                            cameraToSrgb[3*i + j] =
+                                XYZ_TO_SRGB[3*i] * fm[j] + XYZ_TO_SRGB[3*i + 1] * fm[3 + j] + XYZ_TO_SRGB[3*i + 2] * fm[6 + j];
+                        }
+                    }
+                }
+
+                for(int j = 0; j < 3; j++) {
+                    const float neutral = j < static_cast<int>(asShotNeutral.size()) && asShotNeutral[j] > 0 ? asShotNeutral[j] : 1.0f;
+
+                    for(int i = 0; i < 3; i++)
+                        out[3*i + j] = cameraToSrgb[3*i + j] / neutral;
+                }
+            }
+
+            // Sums rows of a plane into acc, eight pixels at a time
+            void SumRows(const uint16_t* src, const size_t stride, const int rows, const int width, uint32_t* acc) {
+                std::fill(acc, acc + width, 0);
+
+                const simde__m128i zero = simde_mm_setzero_si128();
+
+                for(int y = 0; y < rows; y++) {
+                    const uint16_t* row = src + y * stride;
+                    int x = 0;
+
+                    for(; x + 8 <= width; x += 8) {
+                        const simde__m128i pixels = simde_mm_loadu_si128(reinterpret_cast<const simde__m128i*>(row + x));
+
+                        simde__m128i* dst = reinterpret_cast<simde__m128i*>(acc + x);
+
+                        simde_mm_storeu_si128(dst, simde_mm_add_epi32(simde_mm_loadu_si128(dst), simde_mm_unpacklo_epi16(pixels, zero)));
+                        simde_mm_storeu_si128(dst + 1, simde_mm_add_epi32(simde_mm_loadu_si128(dst + 1), simde_mm_unpackhi_epi16(pixels, zero)));
+                    }
+
+                    for(; x < width; x++)
+                        acc[x] += row[x];
+                }
+            }
+
+            uint8_t ToByte(const float v, const uint8_t* lut) {
+                return lut[static_cast<int>(std::min(std::max(v, 0.0f), 1.0f) * (GAMMA_LUT_SIZE - 1) + 0.5f)];
+            }
+        }
+
+        void PreviewSize(const int width, const int height, const int maxWidth, int& outWidth, int& outHeight) {
+            const int scale = Scale(width, maxWidth);
+
+            outWidth = std::max(1, width / 2 / scale);
+            outHeight = std::max(1, height / 2 / scale);
+        }
+
+        void Render(
+            const uint16_t* planes,
+            const int width,
+            const int height,
+            const int maxWidth,
+            const DngCameraInfo& camera,
+            const std::vector<float>& asShotNeutral,
+            uint8_t* out)
+        {
+            const int halfWidth = width / 2;
+            const int halfHeight = height / 2;
+            const size_t planeSize = static_cast<size_t>(halfWidth) * halfHeight;
+            const int scale = Scale(width, maxWidth);
+
+            int previewWidth, previewHeight;
+            PreviewSize(width, height, maxWidth, previewWidth, previewHeight);
+
+            const size_t numPixels = static_cast<size_t>(previewWidth) * previewHeight;
+
+            if(halfWidth < scale || halfHeight < scale) {
+                std::fill(out, out + 3 * numPixels, 0);
+                return;
+            }
+
+            // Box filter the planes down to the preview size into one plane per colour, scaled to [0, 1].
+            // The greens are averaged.
+            int channel[4];
+            int channelPlanes[3] = { 0, 0, 0 };
+
+            for(int k = 0; k < 4; k++) {
+                channel[k] = std::min<int>(camera.cfa[k], 2);
+                channelPlanes[channel[k]]++;
+            }
+
+            std::vector<float> rgb(3 * numPixels, 0.0f);
+            std::vector<uint32_t> sums(halfWidth);
+
+            for(int k = 0; k < 4; k++) {
+                const float black = k < static_cast<int>(camera.blackLevels.size()) ? camera.blackLevels[k] : 0.0f;
+                const float blockBlack = black * scale * scale;
+                const float norm = 1.0f / (std::max(1.0f, static_cast<float>(camera.whiteLevel) - black) * scale * scale * channelPlanes[channel[k]]);
+
+                for(int y = 0; y < previewHeight; y++) {
+                    SumRows(planes + k * planeSize + static_cast<size_t>(y) * scale * halfWidth, halfWidth, scale, halfWidth, sums.data());
+
+                    float* dst = rgb.data() + channel[k] * numPixels + static_cast<size_t>(y) * previewWidth;
+
+                    for(int x = 0; x < previewWidth; x++) {
+                        uint32_t sum = 0;
+                        for(int i = 0; i < scale; i++)
+                            sum += sums[x * scale + i];
+
+                        dst[x] += std::max(0.0f, sum - blockBlack) * norm;
+                    }
+                }
+            }
+
+            // Camera RGB to sRGB four pixels at a time
+            float m[9];
+            ColorMatrix(camera, asShotNeutral, m);
+
+            const uint8_t* lut = GammaLut();
+            const float* r = rgb.data();
+            const float* g = r + numPixels;
+            const float* b = g + numPixels;
+
+            simde__m128 mv[9];
+            for(int i = 0; i < 9; i++)
+                mv[i] = simde_mm_set1_ps(m[i]);
+
+            const simde__m128 zero = simde_mm_setzero_ps();
+            const simde__m128 lutMax = simde_mm_set1_ps(GAMMA_LUT_SIZE - 1);
+
+            int32_t index[4];
+            size_t i = 0;
+
+            for(; i + 4 <= numPixels; i += 4) {
+                const simde__m128 rv = simde_mm_loadu_ps(r + i);
+                const simde__m128 gv = simde_mm_loadu_ps(g + i);
+                const simde__m128 bv = simde_mm_loadu_ps(b + i);
+
+                for(int c = 0; c < 3; c++) {
+                    simde__m128 v = simde_mm_add_ps(
+                        simde_mm_add_ps(simde_mm_mul_ps(mv[3*c], rv), simde_mm_mul_ps(mv[3*c + 1], gv)),
+                        simde_mm_mul_ps(mv[3*c + 2], bv));
+
+                    v = simde_mm_min_ps(simde_mm_max_ps(simde_mm_mul_ps(v, lutMax), zero), lutMax);
+
+                    simde_mm_storeu_si128(reinterpret_cast<simde__m128i*>(index), simde_mm_cvtps_epi32(v));
+
+                    for(int j = 0; j < 4; j++)
+                        out[3 * (i + j) + c] = lut[index[j]];
+                }
+            }
+
+            for(; i < numPixels; i++) {
+                for(int c = 0; c < 3; c++)
+                    out[3*i + c] = ToByte(m[3*c] * r[i] + m[3*c + 1] * g[i] + m[3*c + 2] * b[i], lut);
+            }
+        }
+    } // namespace preview
+} // namespace motioncam
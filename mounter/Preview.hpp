@@ -0,0 +1,45 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef Preview_hpp
+#define Preview_hpp
+
+#include "DngTemplate.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace motioncam {
+    namespace preview {
+        // Size of the preview of a width x height frame, its half resolution image shrunk by the smallest
+        // whole factor that makes it no wider than maxWidth
+        void PreviewSize(const int width, const int height, const int maxWidth, int& outWidth, int& outHeight);
+
+        // Renders the 8-bit sRGB preview of a width x height frame from the colour planes returned by
+        // Decoder::loadFrameProxy. Each pixel of the half resolution image already has every colour so nothing
+        // is interpolated. out holds 3 bytes per pixel of PreviewSize.
+        void Render(
+            const uint16_t* planes,
+            const int width,
+            const int height,
+            const int maxWidth,
+            const DngCameraInfo& camera,
+            const std::vector<float>& asShotNeutral,
+            uint8_t* out);
+    } // namespace preview
+} // namespace motioncam
+
+#endif /* Preview_hpp */
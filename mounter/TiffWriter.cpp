@@ -0,0 +1,233 @@
+#include "TiffWriter.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace motioncam {
+    namespace tiff {
+        namespace {
+            const size_t ENTRY_SIZE = 12;
+        
+            void put16(uint8_t* dst, const uint16_t v) {
+                dst[0] = static_cast<uint8_t>(v);
+                dst[1] = static_cast<uint8_t>(v >> 8);
+            }
+        
+            void put32(uint8_t* dst, const uint32_t v) {
+                dst[0] = static_cast<uint8_t>(v);
+                dst[1] = static_cast<uint8_t>(v >> 8);
+                dst[2] = static_cast<uint8_t>(v >> 16);
+                dst[3] = static_cast<uint8_t>(v >> 24);
+            }
+        
+            // Values are padded to a word boundary
+            size_t paddedSize(const size_t size) {
+                return (size + 1) & ~static_cast<size_t>(1);
+            }
+        
+            // Largest power of two denominator that keeps |value| * denominator within limit
+            uint32_t getDenominator(const double value, const double limit) {
+                uint32_t denominator = 1u << 30;
+                
+                while(denominator > 1 && std::fabs(value) * denominator > limit)
+                    denominator >>= 1;
+                
+                return denominator;
+            }
+        }
+        
+        void WriteHeader(uint8_t* dst, const uint32_t firstIfdOffset) {
+            dst[0] = 'I';
+            dst[1] = 'I';
+            put16(dst + 2, 42);
+            put32(dst + 4, firstIfdOffset);
+        }
+        
+        void ToRational(const float value, uint32_t& outNumerator, uint32_t& outDenominator) {
+            if(!std::isfinite(value) || value <= 0) {
+                outNumerator = 0;
+                outDenominator = 1;
+                return;
+            }
+            
+            uint32_t denominator = getDenominator(value, std::numeric_limits<uint32_t>::max());
+            uint32_t numerator = static_cast<uint32_t>(std::llround(static_cast<double>(value) * denominator));
+            
+            while(denominator > 1 && (numerator & 1) == 0) {
+                numerator >>= 1;
+                denominator >>= 1;
+            }
+            
+            outNumerator = numerator;
+            outDenominator = denominator;
+        }
+        
+        void ToSRational(const float value, int32_t& outNumerator, int32_t& outDenominator) {
+            if(!std::isfinite(value)) {
+                outNumerator = 0;
+                outDenominator = 1;
+                return;
+            }
+            
+            int32_t denominator = static_cast<int32_t>(getDenominator(value, std::numeric_limits<int32_t>::max()));
+            int32_t numerator = static_cast<int32_t>(std::llround(static_cast<double>(value) * denominator));
+            
+            while(denominator > 1 && (numerator % 2) == 0) {
+                numerator /= 2;
+                denominator /= 2;
+            }
+            
+            outNumerator = numerator;
+            outDenominator = denominator;
+        }
+        
+        //
+        
+        void Ifd::set(const uint16_t tag, const Type type, const uint32_t count, const void* data, const size_t size) {
+            Entry& entry = mEntries[tag];
+            
+            entry.type = type;
+            entry.count = count;
+            entry.data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+        }
+        
+        void Ifd::setBytes(const uint16_t tag, const std::vector<uint8_t>& values) {
+            set(tag, Type::BYTE, static_cast<uint32_t>(values.size()), values.data(), values.size());
+        }
+        
+        void Ifd::setUndefined(const uint16_t tag, const std::vector<uint8_t>& values) {
+            set(tag, Type::UNDEFINED, static_cast<uint32_t>(values.size()), values.data(), values.size());
+        }
+        
+        void Ifd::setAscii(const uint16_t tag, const std::string& value) {
+            // Count includes the terminating null
+            set(tag, Type::ASCII, static_cast<uint32_t>(value.size() + 1), value.c_str(), value.size() + 1);
+        }
+        
+        void Ifd::setShort(const uint16_t tag, const uint16_t value) {
+            setShorts(tag, { value });
+        }
+        
+        void Ifd::setShorts(const uint16_t tag, const std::vector<uint16_t>& values) {
+            std::vector<uint8_t> data(values.size() * 2);
+            
+            for(size_t i = 0; i < values.size(); i++)
+                put16(data.data() + 2*i, values[i]);
+            
+            set(tag, Type::SHORT, static_cast<uint32_t>(values.size()), data.data(), data.size());
+        }
+        
+        void Ifd::setLong(const uint16_t tag, const uint32_t value) {
+            setLongs(tag, { value });
+        }
+        
+        void Ifd::setLongs(const uint16_t tag, const std::vector<uint32_t>& values) {
+            std::vector<uint8_t> data(values.size() * 4);
+            
+            for(size_t i = 0; i < values.size(); i++)
+                put32(data.data() + 4*i, values[i]);
+            
+            set(tag, Type::LONG, static_cast<uint32_t>(values.size()), data.data(), data.size());
+        }
+        
+        void Ifd::setRationals(const uint16_t tag, const std::vector<float>& values) {
+            std::vector<uint8_t> data(values.size() * 8);
+            
+            for(size_t i = 0; i < values.size(); i++) {
+                uint32_t numerator, denominator;
+                
+                ToRational(values[i], numerator, denominator);
+                
+                put32(data.data() + 8*i, numerator);
+                put32(data.data() + 8*i + 4, denominator);
+            }
+            
+            set(tag, Type::RATIONAL, static_cast<uint32_t>(values.size()), data.data(), data.size());
+        }
+        
+        void Ifd::setSRationals(const uint16_t tag, const std::vector<float>& values) {
+            std::vector<uint8_t> data(values.size() * 8);
+            
+            for(size_t i = 0; i < values.size(); i++) {
+                int32_t numerator, denominator;
+                
+                ToSRational(values[i], numerator, denominator);
+                
+                put32(data.data() + 8*i, static_cast<uint32_t>(numerator));
+                put32(data.data() + 8*i + 4, static_cast<uint32_t>(denominator));
+            }
+            
+            set(tag, Type::SRATIONAL, static_cast<uint32_t>(values.size()), data.data(), data.size());
+        }
+        
+        bool Ifd::has(const uint16_t tag) const {
+            return mEntries.count(tag) > 0;
+        }
+        
+        void Ifd::remove(const uint16_t tag) {
+            mEntries.erase(tag);
+        }
+        
+        size_t Ifd::size() const {
+            size_t size = 2 + mEntries.size() * ENTRY_SIZE + 4;
+            
+            for(const auto& it : mEntries) {
+                if(it.second.data.size() > 4)
+                    size += paddedSize(it.second.data.size());
+            }
+            
+            return size;
+        }
+        
+        void Ifd::write(uint8_t* dst, const uint32_t offset, const uint32_t nextIfdOffset) const {
+            uint8_t* entry = dst;
+            uint8_t* values = dst + 2 + mEntries.size() * ENTRY_SIZE + 4;
+            
+            put16(entry, static_cast<uint16_t>(mEntries.size()));
+            entry += 2;
+            
+            for(const auto& it : mEntries) {
+                const Entry& e = it.second;
+                
+                put16(entry, it.first);
+                put16(entry + 2, static_cast<uint16_t>(e.type));
+                put32(entry + 4, e.count);
+                
+                if(e.data.size() <= 4) {
+                    std::memset(entry + 8, 0, 4);
+                    std::memcpy(entry + 8, e.data.data(), e.data.size());
+                }
+                else {
+                    put32(entry + 8, offset + static_cast<uint32_t>(values - dst));
+                    
+                    std::memcpy(values, e.data.data(), e.data.size());
+                    if(e.data.size() & 1)
+                        values[e.data.size()] = 0;
+                    
+                    values += paddedSize(e.data.size());
+                }
+                
+                entry += ENTRY_SIZE;
+            }
+            
+            put32(entry, nextIfdOffset);
+        }
+        
+        uint32_t Ifd::valueOffset(const uint16_t tag, const uint32_t offset) const {
+            size_t entryOffset = 2;
+            size_t valuesOffset = 2 + mEntries.size() * ENTRY_SIZE + 4;
+            
+            for(const auto& it : mEntries) {
+                if(it.first == tag)
+                    return offset + static_cast<uint32_t>(it.second.data.size() <= 4 ? entryOffset + 8 : valuesOffset);
+                
+                entryOffset += ENTRY_SIZE;
+                if(it.second.data.size() > 4)
+                    valuesOffset += paddedSize(it.second.data.size());
+            }
+            
+            return 0;
+        }
+    } // namespace tiff
+} // namespace motioncam
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2023 MotionCam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TiffWriter_hpp
+#define TiffWriter_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace motioncam {
+    namespace tiff {
+        enum class Type : uint16_t {
+            BYTE        = 1,
+            ASCII       = 2,
+            SHORT       = 3,
+            LONG        = 4,
+            RATIONAL    = 5,
+            UNDEFINED   = 7,
+            SRATIONAL   = 10,
+            FLOAT       = 11
+        };
+        
+        // Size of the little endian TIFF file header
+        constexpr size_t HEADER_SIZE = 8;
+        
+        // Writes "II*\0" followed by the offset of the first IFD
+        void WriteHeader(uint8_t* dst, const uint32_t firstIfdOffset);
+        
+        // Converts to a rational with a power of two denominator, exact for most values
+        void ToRational(const float value, uint32_t& outNumerator, uint32_t& outDenominator);
+        void ToSRational(const float value, int32_t& outNumerator, int32_t& outDenominator);
+        
+        // A little endian image file directory. Entries are kept sorted by tag and the values that don't fit
+        // in an entry are stored right after the directory, so the whole IFD is one contiguous block.
+        class Ifd {
+        public:
+            void setBytes(const uint16_t tag, const std::vector<uint8_t>& values);
+            void setUndefined(const uint16_t tag, const std::vector<uint8_t>& values);
+            void setAscii(const uint16_t tag, const std::string& value);
+            void setShort(const uint16_t tag, const uint16_t value);
+            void setShorts(const uint16_t tag, const std::vector<uint16_t>& values);
+            void setLong(const uint16_t tag, const uint32_t value);
+            void setLongs(const uint16_t tag, const std::vector<uint32_t>& values);
+            void setRationals(const uint16_t tag, const std::vector<float>& values);
+            void setSRationals(const uint16_t tag, const std::vector<float>& values);
+            
+            bool has(const uint16_t tag) const;
+            void remove(const uint16_t tag);
+            
+            // Bytes taken up by the directory and its values
+            size_t size() const;
+            
+            // Write the IFD to dst, which is at byte offset in the file
+            void write(uint8_t* dst, const uint32_t offset, const uint32_t nextIfdOffset) const;
+            
+            // Byte offset in the file of the value of tag when the IFD is written at offset. Used to patch
+            // values without writing the IFD again.
+            uint32_t valueOffset(const uint16_t tag, const uint32_t offset) const;
+            
+        private:
+            struct Entry {
+                Type type;
+                uint32_t count;
+                std::vector<uint8_t> data;
+            };
+            
+            void set(const uint16_t tag, const Type type, const uint32_t count, const void* data, const size_t size);
+            
+        private:
+            std::map<uint16_t, Entry> mEntries;
+        };
+    } // namespace tiff
+} // namespace motioncam
+
+#endif /* TiffWriter_hpp */